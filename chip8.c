@@ -1,15 +1,57 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+// Batch mode thread pool and ROM directory listing
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include "SDL.h"
+#include "chip8.h"
+
+
+// Beeper switched on or off at an output sample
+typedef struct {
+	uint32_t sample;		// Samples generated before the switch, wraps around
+	bool on;
+} beep_event_t;
 
+#define BEEP_EVENTS 64		// Switches queued ahead of the callback, a few per frame
+
+// Square wave beeper, generated in the SDL audio callback. The emulator
+//	 queues on and off switches at sample positions in a ring only it writes
+//	 events and head to and only the callback writes tail and clock to.
+typedef struct {
+	beep_event_t events[BEEP_EVENTS];
+	SDL_atomic_t head;		// Events queued so far
+	SDL_atomic_t tail;		// Events played so far
+	SDL_atomic_t clock;		// Samples generated so far
+	bool on;				// Beeper on as of clock, callback only
+	uint32_t phase;			// Position in the wave period (32-bit fixed point), callback only
+	uint32_t phase_step;	// Phase advance per sample
+	int16_t volume;			// Square wave amplitude
+	bool queued_on;			// Beeper on after the last queued switch, emulator only
+	uint32_t frame_sample;	// Sample the next frame's audio starts at, emulator only
+	uint32_t frame_samples;	// Samples per 60hz frame
+	uint32_t latency;		// Samples queued frames start ahead of the callback
+} beeper_t;
 
 typedef struct {
 	SDL_Window *window;
 	SDL_Renderer *renderer;
+	SDL_Texture *texture;	// Streaming texture the display is expanded into
+	uint32_t *pixels;		// RGBA8888 staging buffer, window sized
+	uint32_t *tile;			// scale_factor^2 RGBA8888 pattern of a lit pixel
+	uint32_t *bg_row;		// scale_factor pixels of background color
+	SDL_AudioDeviceID audio_dev;
+	beeper_t beeper;		// Audio callback userdata, must not move once the device is open
 } sdl_t;
 
+
 // Emulator configuration
 typedef struct {
 	uint32_t window_width;	// SDL Win width
@@ -18,41 +60,131 @@ typedef struct {
 	uint32_t bg_color;
 	uint32_t scale_factor;	// Amount to scale a CHIP8 pixel
 	bool pixel_outlines;
+	uint32_t square_wave_freq;	// Beeper frequency, hz
+	int16_t volume;			// Beeper amplitude, 0-32767
+	uint32_t audio_sample_rate;	// Audio output samples per second
+	uint16_t audio_buffer_samples;	// Samples per audio callback; smaller is lower latency
+	uint32_t rewind_buffer_size;	// Bytes of rewind history, 0 = rewind disabled
+	uint8_t run_ahead_frames;	// Frames ahead of emulation to display, 0 = off
+	uint32_t seed;			// CXNN random seed, 0 = from the clock (headless: fixed)
+	const char *record_path;	// Record input movie to this file, NULL if not recording
+	const char *replay_path;	// Replay this input movie headless and check it, NULL if not replaying
+	chip8_config_t machine;	// Emulation core, quirk profile and CHIP8 CPU clock rate
+	bool headless;			// Run without SDL as fast as possible, then print results
+	uint64_t max_instructions;	// Headless: instructions to run
+	uint64_t max_frames;	// Headless: 60hz frames to run instead, if set
+	uint32_t instances;		// Headless: copies of the ROM to run on the lockstep batch core, if > 1
+	const char *batch_path;	// Run every ROM in this directory or list file headless, NULL if not batching
+	uint32_t batch_threads;	// Batch worker threads, 0 = one per CPU
+	bool batch_json;		// Batch results as JSON lines rather than CSV
 } config_t;
 
-// Emulator states
-typedef enum {
-	QUIT,
-	RUNNING,
-	PAUSED,
-} emulator_state_t;
-
-// CHIP8 Instruction type
+// Keypad change with the time it happened
 typedef struct {
-	uint16_t opcode;
-	uint16_t NNN;
-	uint8_t NN;
-	uint8_t N;
-	uint8_t X;
-	uint8_t Y;
-} instruction_t;
-
-// CHIP8 Machine object
+	uint32_t timestamp;		// SDL event timestamp, ms
+	uint8_t key;			// CHIP8 key 0x0-0xF
+	bool down;
+} key_event_t;
+
+// Keypad input gathered while waiting out one frame, applied during the next.
+//	 Events are spread over the next frame's instructions by their timestamps.
 typedef struct {
-	emulator_state_t state;
-	uint8_t ram[4096];
-	bool display[64*32];
-	uint16_t stack[12];
-	uint16_t *stack_ptr;
-	uint8_t V[16];				// Data registers V0-VF
-	uint16_t I;					// Index Register
-	uint16_t PC;				// Program counter
-	uint8_t delay_timer;
-	uint8_t sound_timer;
-	bool keypad[16];			// Hexadecimal keypad 0x0-0xF
-	const char *rom_name;		// Currently running ROM
-	instruction_t inst;			// Currently executing instruction
-} chip8_t;
+	key_event_t events[32];
+	uint8_t count;
+	uint32_t window_start;	// SDL ticks when gathering started
+	uint32_t window_end;	// SDL ticks when gathering ended
+	bool rewind;			// Rewind hotkey held
+	movie_t *record;		// Movie applied key changes are recorded to, NULL if not recording
+} input_t;
+
+// SDL audio callback: fill stream with the beeper's square wave, or silence.
+//	 Runs on the audio thread; it shares only the switch ring with the
+//	 emulator, so nothing here can block on it. Each switch lands on the
+//	 sample it was queued for, or the first one generated after if that is
+//	 already past. The phase carries over between calls so the wave stays
+//	 continuous across buffers.
+void audio_callback(void *userdata, uint8_t *stream, int len) {
+	beeper_t *beeper = userdata;
+	int16_t *samples = (int16_t *)stream;
+	const uint32_t head = SDL_AtomicGet(&beeper->head);
+	SDL_MemoryBarrierAcquire();		// Events up to head are written
+	uint32_t tail = SDL_AtomicGet(&beeper->tail);
+	uint32_t clock = SDL_AtomicGet(&beeper->clock);
+
+	for (int i = 0; i < len / 2; i++, clock++) {
+		while (tail != head && (int32_t)(beeper->events[tail % BEEP_EVENTS].sample - clock) <= 0) {
+			beeper->on = beeper->events[tail % BEEP_EVENTS].on;
+			tail++;
+		}
+
+		const int16_t volume = beeper->on ? beeper->volume : 0;
+		samples[i] = (beeper->phase & 0x80000000u) ? volume : -volume;
+		beeper->phase += beeper->phase_step;
+	}
+
+	SDL_AtomicSet(&beeper->tail, tail);
+	SDL_AtomicSet(&beeper->clock, clock);
+}
+
+// Queue a beeper switch at sample, unless the beeper is already switched that
+//	 way. Left for the next frame to retry if the callback is a whole ring behind.
+void beeper_switch(beeper_t *beeper, const uint32_t sample, const bool on) {
+	if (beeper->queued_on == on) return;
+
+	const uint32_t head = SDL_AtomicGet(&beeper->head);
+	if (head - (uint32_t)SDL_AtomicGet(&beeper->tail) == BEEP_EVENTS) return;
+
+	beeper->events[head % BEEP_EVENTS] = (beep_event_t){ .sample = sample, .on = on };
+	SDL_MemoryBarrierRelease();		// Event written before head is
+	SDL_AtomicSet(&beeper->head, head + 1);
+	beeper->queued_on = on;
+}
+
+// Queue the beeper switches of the frame just run, instructions frame_cycles up
+//	 to chip8->cycles, as the next frame_samples of audio. The sound timer's
+//	 start and stop each switch at the sample as far into the frame's audio as
+//	 their instruction is into its instructions. A frame that ran nothing, as
+//	 while paused or rewinding, is silent.
+void beeper_queue_frame(beeper_t *beeper, const chip8_t *chip8, const chip8_config_t *config,
+						const uint64_t frame_cycles, const bool ran) {
+	// Stay latency ahead of the callback: catch up after an underrun or a
+	//	 pause, and fall back if audio ran slower than frames for a while
+	const uint32_t clock = SDL_AtomicGet(&beeper->clock);
+	const int32_t ahead = (int32_t)(beeper->frame_sample - clock);
+	if (ahead < 0 || ahead > (int32_t)(beeper->latency + 2 * beeper->frame_samples)) {
+		beeper->frame_sample = clock + beeper->latency;
+	}
+
+	const uint32_t base = beeper->frame_sample;
+	beeper->frame_sample += beeper->frame_samples;
+
+	uint64_t start, stop;
+	sound_span(chip8, config, &start, &stop);
+	if (start < frame_cycles) start = frame_cycles;
+	const bool stops = (stop < chip8->cycles);	// Otherwise it plays on into the next frame
+
+	if (!ran) {
+		beeper_switch(beeper, base, false);
+		return;
+	}
+	if (chip8->cycles <= frame_cycles) {
+		beeper_switch(beeper, base, sound_playing(chip8, config));	// Idle: no instructions to place it by
+		return;
+	}
+	if (start >= (stops ? stop : chip8->cycles)) {
+		beeper_switch(beeper, base, false);
+		return;
+	}
+
+	const uint64_t cycles = chip8->cycles - frame_cycles;
+	beeper_switch(beeper, base + (uint32_t)((start - frame_cycles) * beeper->frame_samples / cycles), true);
+	if (stops) beeper_switch(beeper, base + (uint32_t)((stop - frame_cycles) * beeper->frame_samples / cycles), false);
+}
+
+// libchip8 log function: core errors are reported like the frontend's own
+void sdl_log(const char *message) {
+	SDL_Log("%s", message);
+}
 
 bool init_sdl(sdl_t *sdl, const config_t config) {
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER) != 0) {
@@ -77,6 +209,58 @@ bool init_sdl(sdl_t *sdl, const config_t config) {
 		return false;
 	}
 
+	const uint32_t width = config.window_width * config.scale_factor;
+	const uint32_t height = config.window_height * config.scale_factor;
+
+	sdl->texture = SDL_CreateTexture(sdl->renderer, SDL_PIXELFORMAT_RGBA8888,
+									 SDL_TEXTUREACCESS_STREAMING, width, height);
+	if (!sdl->texture) {
+		SDL_Log("Could not create SDL texture %s\n", SDL_GetError());
+		return false;
+	}
+
+	sdl->pixels = malloc(width * height * sizeof *sdl->pixels);
+	sdl->tile = malloc(config.scale_factor * config.scale_factor * sizeof *sdl->tile);
+	sdl->bg_row = malloc(config.scale_factor * sizeof *sdl->bg_row);
+	if (!sdl->pixels || !sdl->tile || !sdl->bg_row) {
+		SDL_Log("Could not allocate screen buffers\n");
+		return false;
+	}
+
+	// Precompute a lit pixel, with pixel outlines baked in if requested.
+	//	 Colors are 0xRRGGBBAA, which is already RGBA8888 layout.
+	for (uint32_t ty = 0; ty < config.scale_factor; ty++) {
+		for (uint32_t tx = 0; tx < config.scale_factor; tx++) {
+			const bool edge = (tx == 0 || ty == 0 || tx == config.scale_factor - 1 || ty == config.scale_factor - 1);
+			sdl->tile[ty * config.scale_factor + tx] = (config.pixel_outlines && edge) ? config.bg_color : config.fg_color;
+		}
+		sdl->bg_row[ty] = config.bg_color;
+	}
+
+	// Init audio stuff
+	sdl->beeper.volume = config.volume;
+	sdl->beeper.phase_step = (uint32_t)(((uint64_t)config.square_wave_freq << 32) / config.audio_sample_rate);
+	sdl->beeper.frame_samples = config.audio_sample_rate / 60;
+	sdl->beeper.latency = config.audio_buffer_samples;
+
+	const SDL_AudioSpec want = {
+		.freq = config.audio_sample_rate,
+		.format = AUDIO_S16SYS,		// Signed 16 bit native endian
+		.channels = 1,				// Mono
+		.samples = config.audio_buffer_samples,
+		.callback = audio_callback,
+		.userdata = &sdl->beeper,
+	};
+	SDL_AudioSpec have;
+
+	// No allowed changes: SDL converts from the wanted format if the device differs.
+	//	 Without a device (headless box, no sound card) run silently.
+	sdl->audio_dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+	if (sdl->audio_dev == 0) {
+		SDL_Log("Could not get an Audio Device %s, running without sound\n", SDL_GetError());
+	} else {
+		SDL_PauseAudioDevice(sdl->audio_dev, 0);	// Start the callback, silent until the sound timer runs
+	}
 
 	return true; // Success intialization
 } 
@@ -90,77 +274,128 @@ bool set_config_from_args(config_t *config, const int argc, char *argv[]) {
 		.bg_color = 0x000000FF,
 		.scale_factor = 20,
 		.pixel_outlines = true,		// Draw pixel "outlines" by default
+		.square_wave_freq = 440,	// 440hz for "A" note
+		.volume = 3000,
+		.audio_sample_rate = 44100,	// CD quality
+		.audio_buffer_samples = 256,	// ~6ms at 44100hz
+		.rewind_buffer_size = 8 * 1024 * 1024,	// Many minutes of typical ROMs
+		.run_ahead_frames = 0,
+		.seed = 0,
+		.record_path = NULL,
+		.replay_path = NULL,
+		.machine = {
+			.core = CORE_INTERPRETER,
+			.profile = PROFILE_CHIP8,
+			.insts_per_second = DEFAULT_INSTS_PER_SECOND,
+		},
+		.headless = false,
+		.max_instructions = 10000000,
+		.max_frames = 0,
+		.instances = 1,
+		.batch_path = NULL,
+		.batch_threads = 0,
+		.batch_json = false,
 	};
 
 	// Override defaults from usr cmd arguments
 	for (int i = 1; i < argc; ++i) {
-		(void)argv[i]; // Unused
+		if (strcmp(argv[i], "--core") == 0 && i + 1 < argc) {
+			// --core <interp|jit|block>: select emulation core
+			const char *core = argv[++i];
+			if (strcmp(core, "interp") == 0) config->machine.core = CORE_INTERPRETER;
+			else if (strcmp(core, "jit") == 0) config->machine.core = CORE_JIT;
+			else if (strcmp(core, "block") == 0) config->machine.core = CORE_BLOCK;
+			else {
+				fprintf(stderr, "Unknown core %s, expected interp, jit or block\n", core);
+				return false;
+			}
+		} else if (strcmp(argv[i], "--quirks") == 0 && i + 1 < argc) {
+			// --quirks <chip8|schip|xochip>: select quirk profile
+			const char *profile = argv[++i];
+			if (strcmp(profile, "chip8") == 0) config->machine.profile = PROFILE_CHIP8;
+			else if (strcmp(profile, "schip") == 0) config->machine.profile = PROFILE_SCHIP;
+			else if (strcmp(profile, "xochip") == 0) config->machine.profile = PROFILE_XOCHIP;
+			else {
+				fprintf(stderr, "Unknown quirks %s, expected chip8, schip or xochip\n", profile);
+				return false;
+			}
+		} else if (strcmp(argv[i], "--tone") == 0 && i + 1 < argc) {
+			// --tone <hz>: beeper frequency
+			config->square_wave_freq = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--volume") == 0 && i + 1 < argc) {
+			// --volume <0-32767>: beeper amplitude
+			const long volume = strtol(argv[++i], NULL, 10);
+			config->volume = volume < 0 ? 0 : volume > INT16_MAX ? INT16_MAX : volume;
+		} else if (strcmp(argv[i], "--audio-buffer") == 0 && i + 1 < argc) {
+			// --audio-buffer <samples>: audio callback size, power of 2 from 64 to 8192
+			const char *samples = argv[++i];
+			const unsigned long buffer = strtoul(samples, NULL, 10);
+			if (buffer < 64 || buffer > 8192 || (buffer & (buffer - 1))) {
+				fprintf(stderr, "Invalid audio buffer %s, expected a power of 2 from 64 to 8192\n", samples);
+				return false;
+			}
+			config->audio_buffer_samples = buffer;
+		} else if (strcmp(argv[i], "--rewind-mb") == 0 && i + 1 < argc) {
+			// --rewind-mb <N>: rewind history size in MB, 0 to disable
+			config->rewind_buffer_size = strtoul(argv[++i], NULL, 10) * 1024 * 1024;
+		} else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc) {
+			// --run-ahead <N>: display N frames ahead to hide N frames of input latency
+			const unsigned long frames = strtoul(argv[++i], NULL, 10);
+			config->run_ahead_frames = frames > UINT8_MAX ? UINT8_MAX : frames;
+		} else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			// --seed <N>: CXNN random seed
+			config->seed = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			// --record <file>: record keypad input to a movie file
+			config->record_path = argv[++i];
+		} else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			// --replay <file>: replay a movie file headless at max speed and check final state
+			config->replay_path = argv[++i];
+		} else if (strcmp(argv[i], "--headless") == 0) {
+			// --headless: no SDL, run as fast as possible and print results
+			config->headless = true;
+		} else if (strcmp(argv[i], "--instructions") == 0 && i + 1 < argc) {
+			// --instructions <N>: headless instruction budget
+			config->max_instructions = strtoull(argv[++i], NULL, 10);
+			config->max_frames = 0;
+		} else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			// --frames <N>: headless budget in 60hz frames of insts_per_second (default rate if unlimited)
+			config->max_frames = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+			// --instances <N>: headless, run N copies of the ROM in lockstep, seeded seed..seed+N-1
+			config->instances = strtoul(argv[++i], NULL, 10);
+			if (!config->instances) config->instances = 1;
+		} else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+			// --batch <dir|list>: run every ROM in a directory, or listed one per line, headless
+			config->batch_path = argv[++i];
+		} else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			// --threads <N>: batch worker threads, 0 for one per CPU
+			config->batch_threads = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+			// --format <csv|json>: batch result format
+			const char *format = argv[++i];
+			if (strcmp(format, "csv") == 0) config->batch_json = false;
+			else if (strcmp(format, "json") == 0) config->batch_json = true;
+			else {
+				fprintf(stderr, "Unknown format %s, expected csv or json\n", format);
+				return false;
+			}
+		} else if (strcmp(argv[i], "--ips") == 0 && i + 1 < argc) {
+			// --ips <N>: CHIP8 instructions per second, 0 for unlimited
+			config->machine.insts_per_second = strtoul(argv[++i], NULL, 10);
+		}
 	}
 
 	return true;
 
 }
 
-// Initialize CHIP8 machine
-bool init_chip8(chip8_t *chip8, const char *rom_name) {
-	const uint32_t entry_point = 0x200;
-	const uint8_t font[] = {
-		0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-		0x20, 0x60, 0x20, 0x20, 0x70, // 1
-		0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-		0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-		0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-		0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-		0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-		0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-		0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-		0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-		0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-		0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-		0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-		0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-		0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-		0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-	};
-	
-	// Load font
-	memcpy(&chip8->ram[0], font, sizeof(font));
-
-	// Load ROM 
-	FILE *rom = fopen(rom_name, "rb");
-	if (!rom) {
-		SDL_Log("Rom file %s is corrupted or does not exist.\n", rom_name);
-		return false;
-	}
-
-	// Get/check rom size
-	fseek(rom, 0, SEEK_END);
-	const size_t rom_size = ftell(rom);
-	const size_t max_size = sizeof chip8->ram - entry_point;
-	rewind(rom);
-
-	if (rom_size > max_size) {
-		SDL_Log("Rom file %s is too big. Rom size: %lu; Max size allowed: %lu.\n", rom_name, (unsigned long)rom_size, (unsigned long)max_size);
-		return false;
-	}
-
-	if (fread(&chip8->ram[entry_point], rom_size, 1, rom) != 1) {
-		SDL_Log("Could not read Rom file %s into CHIP8 memory\n", rom_name);
-		return false;
-	}
-
-	fclose(rom);
-
-	// Set chip8 machine defaults
-	chip8->state = RUNNING;
-	chip8->PC = entry_point;
-	chip8->rom_name = rom_name;
-	chip8->stack_ptr = &chip8->stack[0];
-
-	return true;
-}
-
 void final_cleanup(const sdl_t sdl) {
+	if (sdl.audio_dev) SDL_CloseAudioDevice(sdl.audio_dev);
+	free(sdl.pixels);
+	free(sdl.tile);
+	free(sdl.bg_row);
+	if (sdl.texture) SDL_DestroyTexture(sdl.texture);
 	SDL_DestroyRenderer(sdl.renderer);
 	SDL_DestroyWindow(sdl.window);
 	SDL_Quit(); // Shut down SDL
@@ -176,65 +411,128 @@ void clear_screen(const sdl_t sdl, const config_t config) {
 	SDL_RenderClear(sdl.renderer);
 }
 
-void update_screen(const sdl_t sdl, const config_t config, const chip8_t chip8) {
-	SDL_Rect rect = {.x = 0, .y = 0, .w = config.scale_factor, .h = config.scale_factor};
-
-	// Grab color values to draw
-	const uint8_t fg_r = (config.fg_color >> 24) & 0xFF;
-	const uint8_t fg_g = (config.fg_color >> 16) & 0xFF;
-	const uint8_t fg_b = (config.fg_color >>  8) & 0xFF;
-	const uint8_t fg_a = (config.fg_color >>  0) & 0xFF;
-
-	const uint8_t bg_r = (config.bg_color >> 24) & 0xFF;
-	const uint8_t bg_g = (config.bg_color >> 16) & 0xFF;
-	const uint8_t bg_b = (config.bg_color >>  8) & 0xFF;
-	const uint8_t bg_a = (config.bg_color >>  0) & 0xFF;
-
-	// Loop through display pixels, draw a rectangle per pixel to the SDL window
-	for (uint32_t i = 0; i < sizeof chip8.display; i++) {
-		// Translate 1D index i value to 2D X/Y coordinates
-		// X = i % window width
-		// Y = i / window width
-		rect.x = (i % config.window_width) * config.scale_factor;
-		rect.y = (i / config.window_width) * config.scale_factor;
-
-		if (chip8.display[i]) {
-			// If pixel is on, draw foreground color
-			SDL_SetRenderDrawColor(sdl.renderer, fg_r, fg_g, fg_b, fg_a);
-			SDL_RenderFillRect(sdl.renderer, &rect);
-			
-			// If user requested drawing pixel outlines, draw those here
-			if (config.pixel_outlines) {
-				SDL_SetRenderDrawColor(sdl.renderer, bg_r, bg_g, bg_b, bg_a);
-				SDL_RenderDrawRect(sdl.renderer, &rect);
+// Expand dirty display rows into the staging buffer using the precomputed lit
+//	 pixel tile, then upload them and draw with one texture update and one copy.
+//	 Nothing is drawn or presented if no row changed since the last frame.
+void update_screen(const sdl_t sdl, const config_t config, chip8_t *chip8) {
+	const uint32_t dirty_rows = chip8->dirty_rows;
+	if (!dirty_rows) return;
+	chip8->dirty_rows = 0;
+
+	const uint32_t scale = config.scale_factor;
+	const uint32_t pitch = config.window_width * scale;	// Pixels per staging buffer line
+	const size_t tile_row_bytes = scale * sizeof *sdl.pixels;
+	uint32_t first_row = config.window_height, last_row = 0;
+
+	for (uint32_t y = 0; y < config.window_height; y++) {
+		if (!(dirty_rows & (1u << y))) continue;
+		if (y < first_row) first_row = y;
+		last_row = y;
+
+		const uint64_t row = chip8->display[y];
+		uint32_t *line = &sdl.pixels[y * scale * pitch];
+
+		for (uint32_t ty = 0; ty < scale; ty++, line += pitch) {
+			// Interior tile rows are identical, copy the line above instead of expanding again
+			if (ty > 1 && ty < scale - 1) {
+				memcpy(line, line - pitch, pitch * sizeof *line);
+				continue;
 			}
 
-		} else {
-			// Pixel is off, draw background color
-			SDL_SetRenderDrawColor(sdl.renderer, bg_r, bg_g, bg_b, bg_a);
-			SDL_RenderFillRect(sdl.renderer, &rect);
+			const uint32_t *tile_row = &sdl.tile[ty * scale];
+			for (uint32_t x = 0; x < config.window_width; x++) {
+				const bool on = (row << x) >> 63;
+				memcpy(&line[x * scale], on ? tile_row : sdl.bg_row, tile_row_bytes);
+			}
 		}
 	}
 
+	// Upload only the span of rows that changed
+	const SDL_Rect rect = {
+		.x = 0, .y = first_row * scale,
+		.w = pitch, .h = (last_row - first_row + 1) * scale,
+	};
+	SDL_UpdateTexture(sdl.texture, &rect, &sdl.pixels[rect.y * pitch], pitch * sizeof *sdl.pixels);
+	SDL_RenderCopy(sdl.renderer, sdl.texture, NULL, NULL);
 	SDL_RenderPresent(sdl.renderer);
 }
 
-void handle_input(chip8_t *chip8) {
+// Map host key to CHIP8 keypad key, -1 if not mapped
+//	 1 2 3 4      1 2 3 C
+//	 q w e r  ->  4 5 6 D
+//	 a s d f      7 8 9 E
+//	 z x c v      A 0 B F
+int8_t keypad_key(const SDL_Keycode sym) {
+	switch (sym) {
+	case SDLK_1: return 0x1;
+	case SDLK_2: return 0x2;
+	case SDLK_3: return 0x3;
+	case SDLK_4: return 0xC;
+	case SDLK_q: return 0x4;
+	case SDLK_w: return 0x5;
+	case SDLK_e: return 0x6;
+	case SDLK_r: return 0xD;
+	case SDLK_a: return 0x7;
+	case SDLK_s: return 0x8;
+	case SDLK_d: return 0x9;
+	case SDLK_f: return 0xE;
+	case SDLK_z: return 0xA;
+	case SDLK_x: return 0x0;
+	case SDLK_c: return 0xB;
+	case SDLK_v: return 0xF;
+	default: return -1;
+	}
+}
+
+// Apply a keypad change, recording it if a movie is being recorded
+void input_apply(input_t *input, chip8_t *chip8, const key_event_t event) {
+	if (input->record) movie_record(input->record, chip8->cycles, event.key, event.down);
+	chip8_set_key(chip8, event.key, event.down);
+}
+
+// Gather input until deadline (performance counter ticks). The thread sleeps
+//	 in SDL_WaitEventTimeout, so it only wakes for events or the deadline, and
+//	 input is handled once per frame rather than per instruction. While paused
+//	 it sleeps in SDL_WaitEvent until the next event however long that takes,
+//	 then handles any queued behind it and returns so the frame is redrawn.
+void handle_input(chip8_t *chip8, input_t *input, const uint64_t deadline) {
+	const uint64_t perf_freq = SDL_GetPerformanceFrequency();
 	SDL_Event event;
+	bool woken = false;		// Paused wait already returned an event
+
+	input->window_start = input->window_end;
+
+	for (;;) {
+		const uint64_t now = SDL_GetPerformanceCounter();
+		const int timeout_ms = (now < deadline) ? (int)((deadline - now) * 1000 / perf_freq) : 0;
+
+		if (chip8->state == PAUSED && !woken) {
+			if (!SDL_WaitEvent(&event)) break;
+			woken = true;
+		} else if (!SDL_WaitEventTimeout(&event, timeout_ms)) {
+			break;
+		}
 
-	while (SDL_PollEvent(&event)) {
 		switch (event.type) {
 		case SDL_QUIT:
 			chip8->state = QUIT;
 			return;
 
+		case SDL_WINDOWEVENT:
+			// Window contents lost, redraw everything next frame
+			if (event.window.event == SDL_WINDOWEVENT_EXPOSED) chip8->dirty_rows = 0xFFFFFFFF;
+			break;
+
 		case SDL_KEYDOWN:
-			switch (event.key.keysym.sym) {
-			case SDLK_ESCAPE:
+		case SDL_KEYUP: {
+			if (event.key.repeat) break;
+
+			if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE) {
 				chip8->state = QUIT;
 				return;
-				
-			case SDLK_SPACE:
+			}
+
+			if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_SPACE) {
 				// Space bar
 				if (chip8->state == RUNNING) {
 					chip8->state = PAUSED;
@@ -244,201 +542,537 @@ void handle_input(chip8_t *chip8) {
 					chip8->state = RUNNING;
 					puts("------- RESUMED -------");
 				}
-				return;
+				break;
+			}
 
-			default:
+			if (event.type == SDL_KEYDOWN && (event.key.keysym.sym == SDLK_F5 || event.key.keysym.sym == SDLK_F9)) {
+				// F5 saves state next to the ROM, F9 loads it back
+				char path[1024];
+				snprintf(path, sizeof path, "%s.state", chip8->rom_name);
+				if (event.key.keysym.sym == SDLK_F9 && input->record) {
+					// A loaded state can't be reproduced from the movie's start
+					puts("------- CANNOT LOAD STATE WHILE RECORDING -------");
+					break;
+				}
+				if (event.key.keysym.sym == SDLK_F5 ? save_state(chip8, path) : load_state(chip8, path)) {
+					printf("------- %s %s -------\n", event.key.keysym.sym == SDLK_F5 ? "SAVED" : "LOADED", path);
+				}
 				break;
 			}
-			break;
 
-		case SDL_KEYUP:
+			if (event.key.keysym.sym == SDLK_BACKSPACE) {
+				// Backspace: rewind while held
+				input->rewind = (event.type == SDL_KEYDOWN);
+				break;
+			}
+
+			const int8_t key = keypad_key(event.key.keysym.sym);
+			if (key < 0) break;
+
+			const key_event_t key_event = {
+				.timestamp = event.key.timestamp,
+				.key = key,
+				.down = (event.type == SDL_KEYDOWN),
+			};
+
+			// Queue full: apply now rather than drop it
+			if (input->count == sizeof input->events / sizeof input->events[0]) input_apply(input, chip8, key_event);
+			else input->events[input->count++] = key_event;
 			break;
+		}
 
 		default:
 			break;
 		}
 	}
+
+	input->window_end = SDL_GetTicks();
 }
 
-#ifdef DEBUG
-void print_debug_info(chip8_t *chip8) {
-	printf("Address: 0x%04X, Opcode: 0x%04X Desc: ", chip8->PC-2, chip8->inst.opcode);
-	switch ((chip8->inst.opcode >> 12) & 0x0F) {
-	case 0x0:
-		if (chip8->inst.NN == 0xE0) {
-			// 0x00E0: Clear the screen
-			printf("Clear screen\n");
-			// memset(&chip8->display[0], false, sizeof chip8->display);
-
-		} else if (chip8->inst.NN == 0xEE) {
-			// 0x00EE: Return from subroutine
-			// Set PC to last address on subroutine stack ("pop" it off the stack)
-			//	 so that next opcode will be gotten from that address.
-			printf("Return from subroutine to address 0x%04X\n", *(chip8->stack_ptr - 1));
-			// chip8->PC = *--chip8->stack_ptr;
-		} else {
-			printf("Unimplemented opcode.\n");
+// Wall clock time in seconds
+double get_time(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Run count instructions, applying queued key events at the instruction
+//	 matching their position within the input gathering window
+void run_frame(core_state_t *core, chip8_t *chip8, const config_t config,
+			   const uint64_t count, input_t *input) {
+	const uint32_t window = input->window_end - input->window_start;
+	uint64_t done = 0;
+
+	for (uint8_t i = 0; i < input->count; i++) {
+		const key_event_t event = input->events[i];
+		const uint32_t offset = event.timestamp - input->window_start;
+		uint64_t at = (window && offset < window) ? (uint64_t)offset * count / window : 0;
+
+		if (at > done) {
+			run_core(core, chip8, config.machine, at - done);
+			done = at;
 		}
-		break;
-	case 0x01:
-		// 0x1NNN: Jumps to address NNN.
-		printf("Jump to NNN: (0x%04X).\n", chip8->inst.NNN);
-		break;
-	case 0x02:
-		// 0x2NNN: Call subroutine at NNN
-		printf("Call subroutine at NNN (0x%04X)\n",
-				chip8->inst.NNN); 
-		// *chip8->stack_ptr = chip8->PC; 
-		// chip8->PC = chip8->inst.NNN;
-		break;
-
-	case 0x06:
-		// 0x6XNN: Set register VX to NN
-		printf("Set register V%X to NN (%02X)\n", chip8->inst.X, chip8->inst.NN);
-		break;
-
-	case 0x07:
-		// 0x7XNN: Set register VX += NN
-		printf("Set register V%X (0x%02X) += NN (0x%02X). Result: 0x%02X\n",
-				chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.NN,
-				chip8->V[chip8->inst.X] + chip8->inst.NN);
-		break;
-
-	case 0x0A:
-		// 0xANNN: Set index register I to NNN
-		printf("Set I to NNN (0x%04X)\n", chip8->inst.NNN);
-		break;
-
-	case 0x0D:
-		// 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
-		//		Screen pixels are XOR'd with sprite bits,   
-		//		VF (Carry flag) is set if any screen pixels are set off;
-		// 		for collision detection or other reasons.
-
-		printf("Draw N (%u) height sprite at coords V%X (0x%02X), V%X (0x%02X) "
-			   "from memory location I (0x%04X). Set VF = 1 if any pixels are turned off.\n",
-			   chip8->inst.N, chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.Y,
-			   chip8->V[chip8->inst.Y], chip8->I);
-		break;
-
-	default:
-		printf("Unimplemented opcode.\n");
-		break; // Unimplemented/invalid
+		input_apply(input, chip8, event);
 	}
+	input->count = 0;
+
+	run_core(core, chip8, config.machine, count - done);
 }
-#endif
 
+// Run-ahead: display the machine as it will be run_ahead_frames frames from
+//	 now if the keypad stays as it is, then restore it. Games that react to
+//	 input a few frames late appear to react that many frames sooner. This
+//	 costs a snapshot and restore per frame on top of emulating the extra
+//	 frames; remainder is the frame loop's, copied so it does not advance.
+void update_screen_run_ahead(const sdl_t sdl, const config_t config, core_state_t *core,
+							 chip8_t *chip8, uint32_t remainder) {
+	chip8_snapshot_t snapshot;
+	chip8_snapshot(chip8, &snapshot);
+
+	for (uint8_t frame = 0; frame < config.run_ahead_frames; frame++) {
+		run_core(core, chip8, config.machine, instructions_this_frame(config.machine, &remainder));
+	}
+	update_screen(sdl, config, chip8);
 
-// Emulate 1 CHIP8 instruction
-void emulate_instruction(chip8_t *chip8, config_t config) {
-	// Get next opcode from ram
-	chip8->inst.opcode = (chip8->ram[chip8->PC] << 8) | chip8->ram[chip8->PC+1];
-	chip8->PC += 2; 	// Increment PC for next opcode
+	chip8_restore(chip8, &snapshot);	// Marks rows that differ from what was shown dirty
+}
 
-	// Fill out current instruction format
-	chip8->inst.NNN = chip8->inst.opcode & 0x0FFF;
-	chip8->inst.NN = chip8->inst.opcode & 0x0FF;
-	chip8->inst.N = chip8->inst.opcode & 0x0F;
-	chip8->inst.X = (chip8->inst.opcode >> 8) & 0x0F;
-	chip8->inst.Y = (chip8->inst.opcode >> 4) & 0x0F;
-	
-#ifdef DEBUG
-	print_debug_info(chip8);
-#endif
-
-	// Emulate opcode
-	switch ((chip8->inst.opcode >> 12) & 0x0F) {
-	case 0x0:
-		if (chip8->inst.NN == 0xE0) {
-			// 0x00E0: Clear the screen
-			memset(&chip8->display[0], false, sizeof chip8->display);
-		} else if (chip8->inst.NN == 0xEE) {
-			// 0x00EE: Return from subroutine
-			// Set PC to last address on subroutine stack ("pop" it off the stack)
-			//	 so that next opcode will be gotten from that address.
-			chip8->PC = *--chip8->stack_ptr;
+// Instructions in the next frame of the headless budget. An unlimited rate
+//	 counts frames at the default rate, the same frames its timers tick at.
+uint64_t budget_frame(const config_t config, uint32_t *remainder) {
+	chip8_config_t rate = config.machine;
+	if (!rate.insts_per_second) rate.insts_per_second = DEFAULT_INSTS_PER_SECOND;
+	return instructions_this_frame(rate, remainder);
+}
 
+// Run the headless budget: max_frames 60hz frames, or max_instructions
+void run_budget(core_state_t *core, chip8_t *chip8, const config_t config) {
+	if (config.max_frames) {
+		uint32_t remainder = 0;
+		for (uint64_t frame = 0; frame < config.max_frames; frame++) {
+			run_core(core, chip8, config.machine, budget_frame(config, &remainder));
 		}
-		break;
-
-	case 0x01:
-		// 0x1NNN: Jump to address NNN
-		chip8->PC = chip8->inst.NNN;	// Set PC so that next opcode is from NNN
-		break;
-
-	case 0x02:
-		// 0x2NNN: Call subroutine at NNN 
-		*chip8->stack_ptr++ = chip8->PC;
-		chip8->PC = chip8->inst.NNN;
-		break;
-
-	// case 0x03:
-	// 	if (chip8->V[chip8->inst.X] == chip8->inst.NN) break;
-	// 	break;
-
-	case 0x06:
-		// 0x6XNN: Set register VX to NN
-		chip8->V[chip8->inst.X] = chip8->inst.NN;
-		break;
-
-	case 0x07:
-		// 0x7XNN: Set register VX += NN
-		chip8->V[chip8->inst.X] += chip8->inst.NN;
-		break;
-
-	case 0x0A:
-		// 0xANNN: Set index register I to NNN
-		chip8->I = chip8->inst.NNN;
-		break;
-
-	case 0x0D:
-		// 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
-		//		Screen pixels are XOR'd with sprite bits,   
-		//		VF (Carry flag) is set if any screen pixels are set off;
-		// 		for collision detection or other reasons.
-		uint8_t X_coord = chip8->V[chip8->inst.X] % config.window_width;
-		uint8_t Y_coord = chip8->V[chip8->inst.Y] % config.window_height;
-		const uint8_t orig_X = X_coord; // Original X value
-
-		chip8->V[0xF] = 0; // Init carry flag VF to 0
-		
-		// Loop over all N rows of the sprite
-		for (uint8_t i = 0; i < chip8->inst.N; ++i) {
-			// Get next byte/row of sprite data
-			const uint8_t sprite_data = chip8->ram[chip8->I + i];
-			X_coord = orig_X;	// Reset X for next row to draw
-
-			for (int8_t j = 7; j >= 0; j--) {
-				// if sprite pixel/bit is on and display pixel is on, set carry flag
-				bool *pixel = &chip8->display[Y_coord * config.window_width + X_coord];
-				const bool sprite_bit = (sprite_data & (1 << j));
-
-				if (sprite_bit && *pixel) {
-					chip8->V[0xF] = 1;
-				}
+	} else {
+		run_core(core, chip8, config.machine, config.max_instructions);
+	}
+}
 
-				// XOR display pixel with sprite pixel/bit
-				*pixel ^= sprite_bit;
+// Run ROM without SDL for a fixed budget as fast as possible and print results
+int run_headless(const config_t config, const char *rom_name) {
+	chip8_t chip8 = {0};
+	if (!init_chip8(&chip8, rom_name)) return EXIT_FAILURE;
+	seed_chip8(&chip8, config.seed);	// Fixed seed unless given, so runs compare
+
+	core_state_t core;
+	if (!init_core(&core, config.machine)) return EXIT_FAILURE;
+
+	const double start = get_time();
+	run_budget(&core, &chip8, config);
+	const double elapsed = get_time() - start;
+
+	printf("ROM: %s\n", rom_name);
+	printf("Core: %s\n", core_name(&core));
+	printf("Instructions: %llu\n", (unsigned long long)chip8.cycles);
+	printf("Time: %.6f s\n", elapsed);
+	printf("Instructions/second: %.0f\n", elapsed > 0 ? chip8.cycles / elapsed : 0.0);
+	printf("State hash: 0x%016llX\n", (unsigned long long)hash_state(&chip8));
+	printf("Framebuffer hash: 0x%016llX\n", (unsigned long long)hash_framebuffer(&chip8));
+
+	destroy_core(&core);
+	chip8_unload(&chip8);
+	return EXIT_SUCCESS;
+}
 
-				// Stop drawing this row if hit right edge of screen
-				if (++X_coord >= config.window_width) break;
-			}
-			// Stop drawing entire sprite if hit bottom edge of screen
-			if (++Y_coord >= config.window_height) break;
+// Run copies of a ROM headless on the lockstep batch core and print results.
+//	 Instance i is seeded with seed + i, so instance 0 matches plain --headless.
+int run_lockstep(const config_t config, const char *rom_name) {
+	chip8_t chip8 = {0};
+	if (!init_chip8(&chip8, rom_name)) return EXIT_FAILURE;
+
+	chip8_batch_t *batch = chip8_batch_create(&chip8, config.instances);
+	if (!batch) {
+		fprintf(stderr, "Could not allocate %u instances\n", config.instances);
+		return EXIT_FAILURE;
+	}
+	for (uint32_t i = 0; i < config.instances; i++) {
+		seed_chip8(&chip8, config.seed + i);
+		batch->rng[i] = chip8.rng;
+	}
+
+	const double start = get_time();
+
+	if (config.max_frames) {
+		uint32_t remainder = 0;
+		for (uint64_t frame = 0; frame < config.max_frames; frame++) {
+			chip8_batch_run(batch, config.machine, budget_frame(config, &remainder));
+		}
+	} else {
+		chip8_batch_run(batch, config.machine, config.max_instructions);
+	}
+
+	const double elapsed = get_time() - start;
+
+	// Instance 0 for comparison with other cores, plus every framebuffer
+	uint64_t framebuffers = FNV1A_INIT;
+	for (uint32_t i = config.instances; i-- > 0; ) {
+		chip8_batch_get(batch, i, &chip8);
+		const uint64_t hash = hash_framebuffer(&chip8);
+		framebuffers = fnv1a(framebuffers, &hash, sizeof hash);
+	}
+	const uint64_t instructions = chip8.cycles * config.instances;
+
+	printf("ROM: %s\n", rom_name);
+	printf("Core: lockstep (%s) x %u\n", chip8_batch_isa(), config.instances);
+	printf("Instructions: %llu per instance, %llu total\n",
+		   (unsigned long long)chip8.cycles, (unsigned long long)instructions);
+	printf("Time: %.6f s\n", elapsed);
+	printf("Instructions/second: %.0f\n", elapsed > 0 ? instructions / elapsed : 0.0);
+	printf("State hash: 0x%016llX (instance 0)\n", (unsigned long long)hash_state(&chip8));
+	printf("Framebuffer hash: 0x%016llX (instance 0)\n", (unsigned long long)hash_framebuffer(&chip8));
+	printf("All framebuffers hash: 0x%016llX\n", (unsigned long long)framebuffers);
+
+	chip8_batch_destroy(batch);
+	chip8_unload(&chip8);
+	return EXIT_SUCCESS;
+}
+
+// Replay a recorded movie headless as fast as possible and check that it ends
+//	 in the same state it was recorded in
+int run_replay(config_t config, const char *rom_name) {
+	movie_t movie;
+	if (!movie_load(&movie, config.replay_path)) return EXIT_FAILURE;
+
+	chip8_t chip8 = {0};
+	if (!init_chip8(&chip8, rom_name)) {
+		free(movie.events);
+		return EXIT_FAILURE;
+	}
+	if (hash_ram(&chip8) != movie.rom_hash) {
+		fprintf(stderr, "Movie %s was recorded with a different ROM\n", config.replay_path);
+		free(movie.events);
+		return EXIT_FAILURE;
+	}
+	seed_chip8(&chip8, movie.seed);
+
+	// Timers and quirks must run exactly as they did while recording
+	config.machine.insts_per_second = movie.insts_per_second;
+	config.machine.profile = movie.profile;
+
+	core_state_t core;
+	if (!init_core(&core, config.machine)) {
+		free(movie.events);
+		return EXIT_FAILURE;
+	}
+
+	const double start = get_time();
+
+	for (uint32_t i = 0; i < movie.count; i++) {
+		run_core(&core, &chip8, config.machine, movie.events[i].cycle - chip8.cycles);
+		chip8_set_key(&chip8, movie.events[i].key, movie.events[i].down);
+	}
+	run_core(&core, &chip8, config.machine, movie.final_cycles - chip8.cycles);
+
+	const double elapsed = get_time() - start;
+
+	const uint64_t state_hash = hash_state(&chip8);
+	const uint64_t framebuffer_hash = hash_framebuffer(&chip8);
+	const bool match = chip8.cycles == movie.final_cycles && state_hash == movie.state_hash &&
+					   framebuffer_hash == movie.framebuffer_hash;
+
+	printf("ROM: %s\n", rom_name);
+	printf("Movie: %s (%u key changes)\n", config.replay_path, movie.count);
+	printf("Core: %s\n", core_name(&core));
+	printf("Instructions: %llu\n", (unsigned long long)chip8.cycles);
+	printf("Time: %.6f s\n", elapsed);
+	printf("Instructions/second: %.0f\n", elapsed > 0 ? chip8.cycles / elapsed : 0.0);
+	printf("State hash: 0x%016llX (recorded 0x%016llX)\n",
+		   (unsigned long long)state_hash, (unsigned long long)movie.state_hash);
+	printf("Framebuffer hash: 0x%016llX (recorded 0x%016llX)\n",
+		   (unsigned long long)framebuffer_hash, (unsigned long long)movie.framebuffer_hash);
+	printf("Replay: %s\n", match ? "OK" : "MISMATCH");
+
+	destroy_core(&core);
+	chip8_unload(&chip8);
+	free(movie.events);
+	return match ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// One ROM of a batch run and its results
+typedef struct {
+	char *rom_name;
+	bool ok;				// ROM loaded and ran its budget
+	uint64_t instructions;
+	uint64_t framebuffer_hash;
+	uint64_t state_hash;
+	double seconds;			// Wall time of the run, excluding load
+} batch_job_t;
+
+// Jobs [next, end) owned by one worker. The owner takes from the front and
+//	 idle workers steal half from the back, so each lock is rarely contended.
+typedef struct {
+	pthread_mutex_t lock;
+	uint32_t next;
+	uint32_t end;
+} batch_queue_t;
+
+typedef struct {
+	config_t config;
+	batch_job_t *jobs;
+	batch_queue_t *queues;	// One per worker
+	uint32_t worker_count;
+} batch_t;
+
+typedef struct {
+	batch_t *batch;
+	uint32_t id;
+} batch_worker_t;
+
+// Take the next job from a worker's own queue, UINT32_MAX if it is empty
+static uint32_t batch_take(batch_queue_t *queue) {
+	pthread_mutex_lock(&queue->lock);
+	const uint32_t job = (queue->next < queue->end) ? queue->next++ : UINT32_MAX;
+	pthread_mutex_unlock(&queue->lock);
+	return job;
+}
+
+// Move half of another worker's remaining jobs into our empty queue
+static bool batch_steal(batch_t *batch, const uint32_t id) {
+	for (uint32_t i = 1; i < batch->worker_count; i++) {
+		batch_queue_t *victim = &batch->queues[(id + i) % batch->worker_count];
+
+		pthread_mutex_lock(&victim->lock);
+		const uint32_t stolen = (victim->end - victim->next + 1) / 2;
+		victim->end -= stolen;
+		const uint32_t end = victim->end + stolen;
+		pthread_mutex_unlock(&victim->lock);
+
+		if (stolen) {
+			batch_queue_t *queue = &batch->queues[id];
+			pthread_mutex_lock(&queue->lock);
+			queue->next = end - stolen;
+			queue->end = end;
+			pthread_mutex_unlock(&queue->lock);
+			return true;
+		}
+	}
+	return false;	// Every queue is empty; jobs are never added, so we're done
+}
+
+// Load and run one ROM for the configured budget on a worker's machine
+static void batch_run_job(batch_job_t *job, core_state_t *core, chip8_t *chip8, const config_t config) {
+	if (!init_chip8(chip8, job->rom_name)) return;	// Resets whatever the last ROM left
+	seed_chip8(chip8, config.seed);
+
+	const double start = get_time();
+	run_budget(core, chip8, config);
+	job->seconds = get_time() - start;
+
+	job->instructions = chip8->cycles;
+	job->framebuffer_hash = hash_framebuffer(chip8);
+	job->state_hash = hash_state(chip8);
+	job->ok = true;
+}
+
+static void *batch_worker(void *arg) {
+	const batch_worker_t *worker = arg;
+	batch_t *batch = worker->batch;
+
+	// Machine and core reused for every ROM this worker runs: loading a ROM
+	//	 drops the core's caches of the last one
+	chip8_t *chip8 = chip8_create();
+	if (!chip8) return NULL;	// Its jobs are stolen by the other workers
+	core_state_t core;
+	if (!init_core(&core, batch->config.machine)) {
+		chip8_destroy(chip8);
+		return NULL;
+	}
+
+	for (;;) {
+		const uint32_t job = batch_take(&batch->queues[worker->id]);
+		if (job != UINT32_MAX) {
+			batch_run_job(&batch->jobs[job], &core, chip8, batch->config);
+		} else if (!batch_steal(batch, worker->id)) {
+			break;
+		}
+	}
+
+	destroy_core(&core);
+	chip8_destroy(chip8);
+	return NULL;
+}
+
+// Append a ROM path to the batch, growing the job array as needed
+static bool batch_add(batch_job_t **jobs, uint32_t *count, uint32_t *capacity, const char *rom_name) {
+	if (*count == *capacity) {
+		const uint32_t grown_capacity = *capacity ? *capacity * 2 : 64;
+		batch_job_t *grown = realloc(*jobs, grown_capacity * sizeof **jobs);
+		if (!grown) return false;
+		*jobs = grown;
+		*capacity = grown_capacity;
+	}
+	(*jobs)[*count] = (batch_job_t){ .rom_name = malloc(strlen(rom_name) + 1) };
+	if (!(*jobs)[*count].rom_name) return false;
+	strcpy((*jobs)[*count].rom_name, rom_name);
+	(*count)++;
+	return true;
+}
+
+static int batch_compare(const void *a, const void *b) {
+	return strcmp(((const batch_job_t *)a)->rom_name, ((const batch_job_t *)b)->rom_name);
+}
+
+// Collect ROM paths: every regular file in a directory (sorted, so output
+//	 order is stable), or a list file of paths, one per line, # comments
+bool batch_collect(const char *path, batch_job_t **jobs, uint32_t *count) {
+	*jobs = NULL;
+	*count = 0;
+	uint32_t capacity = 0;	// Jobs the array has room for
+
+	struct stat info;
+	if (stat(path, &info) != 0) {
+		fprintf(stderr, "Batch path %s does not exist\n", path);
+		return false;
+	}
+
+	char rom_name[4096];
+	if (S_ISDIR(info.st_mode)) {
+		DIR *dir = opendir(path);
+		if (!dir) {
+			fprintf(stderr, "Could not open batch directory %s\n", path);
+			return false;
+		}
+		for (struct dirent *entry; (entry = readdir(dir)); ) {
+			if (entry->d_name[0] == '.') continue;
+			snprintf(rom_name, sizeof rom_name, "%s/%s", path, entry->d_name);
+			if (stat(rom_name, &info) != 0 || !S_ISREG(info.st_mode)) continue;
+			if (!batch_add(jobs, count, &capacity, rom_name)) break;
 		}
-		break;
+		closedir(dir);
+		if (*count) qsort(*jobs, *count, sizeof **jobs, batch_compare);
+	} else {
+		FILE *list = fopen(path, "r");
+		if (!list) {
+			fprintf(stderr, "Could not open batch list %s\n", path);
+			return false;
+		}
+		while (fgets(rom_name, sizeof rom_name, list)) {
+			rom_name[strcspn(rom_name, "\r\n")] = '\0';
+			if (rom_name[0] == '\0' || rom_name[0] == '#') continue;
+			if (!batch_add(jobs, count, &capacity, rom_name)) break;
+		}
+		fclose(list);
+	}
 
+	return true;
+}
 
-	default:
-		break; // Unimplemented/invalid
+// Print a string as a CSV field, quoted if it needs to be
+static void print_csv_string(const char *str) {
+	if (!str[strcspn(str, ",\"\r\n")]) {
+		fputs(str, stdout);
+		return;
 	}
+	putchar('"');
+	for (; *str; str++) {
+		if (*str == '"') putchar('"');
+		putchar(*str);
+	}
+	putchar('"');
+}
+
+// Print a string as a quoted JSON string
+static void print_json_string(const char *str) {
+	putchar('"');
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') printf("\\%c", *str);
+		else if ((uint8_t)*str < 0x20) printf("\\u%04x", *str);
+		else putchar(*str);
+	}
+	putchar('"');
+}
 
+// Worker threads to run, one per CPU unless configured
+static uint32_t batch_thread_count(const config_t config, const uint32_t jobs) {
+	uint32_t threads = config.batch_threads ? config.batch_threads : chip8_cpu_count();
+	if (threads > jobs) threads = jobs;
+	return threads ? threads : 1;
+}
+
+// Run every ROM of a batch headless on a thread pool, then print one CSV or
+//	 JSON line per ROM in collection order. SDL is never initialized.
+int run_batch(const config_t config) {
+	batch_t batch = { .config = config };
+	uint32_t job_count;
+	if (!batch_collect(config.batch_path, &batch.jobs, &job_count)) return EXIT_FAILURE;
+
+	batch.worker_count = batch_thread_count(config, job_count);
+	batch.queues = calloc(batch.worker_count, sizeof *batch.queues);
+	batch_worker_t *workers = calloc(batch.worker_count, sizeof *workers);
+	pthread_t *threads = calloc(batch.worker_count, sizeof *threads);
+	if (!batch.queues || !workers || !threads) {
+		fprintf(stderr, "Could not allocate batch of %u ROMs\n", job_count);
+		return EXIT_FAILURE;
+	}
+
+	// Deal jobs out in contiguous ranges; stealing evens out uneven ROMs
+	for (uint32_t i = 0; i < batch.worker_count; i++) {
+		pthread_mutex_init(&batch.queues[i].lock, NULL);
+		batch.queues[i].next = (uint64_t)job_count * i / batch.worker_count;
+		batch.queues[i].end = (uint64_t)job_count * (i + 1) / batch.worker_count;
+		workers[i] = (batch_worker_t){ .batch = &batch, .id = i };
+	}
+
+	const double start = get_time();
+
+	// Worker 0 is this thread
+	uint32_t started = 1;
+	while (started < batch.worker_count &&
+		   pthread_create(&threads[started], NULL, batch_worker, &workers[started]) == 0) {
+		started++;
+	}
+	batch_worker(&workers[0]);	// Steals the jobs of any thread that failed to start
+	for (uint32_t i = 1; i < started; i++) pthread_join(threads[i], NULL);
+
+	const double elapsed = get_time() - start;
+
+	uint32_t failed = 0;
+	if (!config.batch_json) puts("rom,status,instructions,framebuffer_hash,state_hash,seconds");
+	for (uint32_t i = 0; i < job_count; i++) {
+		const batch_job_t *job = &batch.jobs[i];
+		failed += !job->ok;
+		if (config.batch_json) {
+			fputs("{\"rom\":", stdout);
+			print_json_string(job->rom_name);
+			printf(",\"status\":\"%s\",\"instructions\":%llu,\"framebuffer_hash\":\"0x%016llX\","
+				   "\"state_hash\":\"0x%016llX\",\"seconds\":%.6f}\n",
+				   job->ok ? "ok" : "error", (unsigned long long)job->instructions,
+				   (unsigned long long)job->framebuffer_hash, (unsigned long long)job->state_hash, job->seconds);
+		} else {
+			print_csv_string(job->rom_name);
+			printf(",%s,%llu,0x%016llX,0x%016llX,%.6f\n",
+				   job->ok ? "ok" : "error", (unsigned long long)job->instructions,
+				   (unsigned long long)job->framebuffer_hash, (unsigned long long)job->state_hash, job->seconds);
+		}
+	}
+	fprintf(stderr, "Ran %u ROMs (%u failed) on %u threads in %.3f s\n",
+			job_count, failed, batch.worker_count, elapsed);
+
+	for (uint32_t i = 0; i < job_count; i++) free(batch.jobs[i].rom_name);
+	for (uint32_t i = 0; i < batch.worker_count; i++) pthread_mutex_destroy(&batch.queues[i].lock);
+	free(batch.jobs);
+	free(batch.queues);
+	free(workers);
+	free(threads);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 int main(int argc, char *argv[]) {
 	// Default usage message for args
 	if (argc < 2) {
-		fprintf(stderr, "Usage %s <rom_name>\n", argv[0]);
+		fprintf(stderr, "Usage %s <rom_name> [--core interp|jit|block] [--ips N] "
+				"[--headless [--instructions N | --frames N] [--instances N]] [--seed N] [--record file | --replay file]\n"
+				"      %s --batch <dir|list> [--threads N] [--format csv|json] [--instructions N | --frames N]\n",
+				argv[0], argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
@@ -446,41 +1080,132 @@ int main(int argc, char *argv[]) {
 	config_t config = {0};
 	if (!set_config_from_args(&config, argc, argv)) exit(EXIT_FAILURE);
 
+	const char *rom_name = argv[1];
+
+	// Batch, headless and replay modes never bring up SDL
+	if (config.batch_path) exit(run_batch(config));
+	if (config.headless && config.instances > 1) exit(run_lockstep(config, rom_name));
+	if (config.headless) exit(run_headless(config, rom_name));
+	if (config.replay_path) exit(run_replay(config, rom_name));
+
+	// Interactive: libchip8 errors go where the frontend's own do, not stderr
+	chip8_set_log(sdl_log);
+
 	// Init SDL
 	sdl_t sdl = {0};
 	if (!init_sdl(&sdl, config)) exit(EXIT_FAILURE);
 
 	// Initialize CHIP8 machine
 	chip8_t chip8 = {0};
-	const char *rom_name = argv[1];
 	if (!init_chip8(&chip8, rom_name)) exit(EXIT_FAILURE);
+	const uint32_t seed = config.seed ? config.seed : (uint32_t)time(NULL);
+	seed_chip8(&chip8, seed);
+
+	core_state_t core;
+	if (!init_core(&core, config.machine)) exit(EXIT_FAILURE);
+
+	// Everything a replay needs to start from the same state as this run
+	movie_t movie = {
+		.rom_hash = hash_ram(&chip8),
+		.seed = seed,
+		.insts_per_second = config.machine.insts_per_second,
+		.profile = config.machine.profile,
+	};
+	if (config.record_path && !config.machine.insts_per_second) {
+		SDL_Log("Recording needs a fixed instruction rate (--ips), not recording\n");
+		config.record_path = NULL;
+	}
+
+	rewind_t *history = NULL;
+	if (config.rewind_buffer_size) {
+		history = rewind_create(config.rewind_buffer_size);
+		if (!history) SDL_Log("Could not allocate rewind buffer, rewind disabled\n");
+	}
 
 	// init screen clear
 	clear_screen(sdl, config);
 
-	// Main emulator loop
+	// Frame deadlines are computed from the start time and frame count rather
+	//	 than accumulated sleeps, so sleep overshoot never adds up to drift.
+	const uint64_t perf_freq = SDL_GetPerformanceFrequency();
+	uint64_t frames_start = SDL_GetPerformanceCounter();
+	uint64_t frame_count = 0;
+	uint32_t inst_remainder = 0;
+	input_t input = { .window_end = SDL_GetTicks(), .record = config.record_path ? &movie : NULL };
+
+	// Main emulator loop, one iteration per 60hz frame
 	while (chip8.state != QUIT) {
-		// Handle user input
-		handle_input(&chip8);
+		const uint64_t frame_end = frames_start + (frame_count + 1) * perf_freq / 60;
+		const uint64_t frame_cycles = chip8.cycles;	// Instruction count at the start of this frame
+		const bool ran = (chip8.state == RUNNING && !(history && input.rewind));	// Emulated forward this frame
+
+		if (chip8.state == RUNNING && history && input.rewind) {
+			// Rewinding: step back one frame per frame instead of emulating.
+			//	 Key changes still apply so no press or release is lost.
+			if (rewind_pop(history, &chip8) && input.record) movie_truncate(input.record, chip8.cycles);
+			for (uint8_t i = 0; i < input.count; i++) input_apply(&input, &chip8, input.events[i]);
+			input.count = 0;
+		} else if (chip8.state == RUNNING) {
+			// Emulate CHIP8 Instructions for this frame
+			if (config.machine.insts_per_second) {
+				run_frame(&core, &chip8, config, instructions_this_frame(config.machine, &inst_remainder), &input);
+			} else {
+				// Unlimited: no fixed instruction count to spread input over
+				for (uint8_t i = 0; i < input.count; i++) input_apply(&input, &chip8, input.events[i]);
+				input.count = 0;
+
+				// Unlimited: run in chunks until the frame's time is used up, or
+				//	 the ROM goes idle and the rest of the frame can be slept
+				while (!chip8_is_idle(&chip8) && SDL_GetPerformanceCounter() < frame_end) {
+					run_core(&core, &chip8, config.machine, 1024);
+				}
+			}
 
-		if (chip8.state == PAUSED) continue;
-		
+			if (history) rewind_push(history, &chip8);
+		}
 
-		// Get_time();
-		// Emulate CHIP8 Instructions
-		emulate_instruction(&chip8, config);
+		// Beep while the sound timer runs, switching at the samples matching
+		//	 the instructions it starts and stops at; silent while paused
+		if (sdl.audio_dev) beeper_queue_frame(&sdl.beeper, &chip8, &config.machine, frame_cycles, ran);
 
-		// Get_time() elapsed since last get_time();
+		// Update window, from the future with run-ahead (needs a fixed instruction rate)
+		if (chip8.state == RUNNING && config.run_ahead_frames && config.machine.insts_per_second) {
+			update_screen_run_ahead(sdl, config, &core, &chip8, inst_remainder);
+		} else {
+			update_screen(sdl, config, &chip8);
+		}
 
-		// Delay for ~ 60hz
-		SDL_Delay(16);
+		// Handle user input while waiting for next frame deadline, or for the
+		//	 next event while paused
+		const bool paused = (chip8.state == PAUSED);
+		handle_input(&chip8, &input, frame_end);
 
-		// Update window
-		update_screen(sdl, config, chip8);
+		const uint64_t now = SDL_GetPerformanceCounter();
+		frame_count++;
+
+		// Woke from a pause, or fell more than a frame behind (e.g. window
+		//	 dragged): pace frames from now instead of catching up
+		if (paused || now > frame_end + perf_freq / 60) {
+			frames_start = now;
+			frame_count = 0;
+		}
+	}
+
+	if (config.record_path) {
+		movie.final_cycles = chip8.cycles;
+		movie.state_hash = hash_state(&chip8);
+		movie.framebuffer_hash = hash_framebuffer(&chip8);
+		if (movie_save(&movie, config.record_path)) {
+			printf("Recorded %u key changes to %s\n", movie.count, config.record_path);
+		}
 	}
 
 	// Cleanup
+	free(movie.events);
+	rewind_destroy(history);
+	destroy_core(&core);
+	chip8_unload(&chip8);
 	final_cleanup(sdl);
 
 	exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+}
@@ -0,0 +1,278 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+// libchip8: the CHIP8 machine and its emulation cores, with no SDL or other
+//	 platform dependency. Create a machine with chip8_create(), load a ROM
+//	 from memory with chip8_load_rom(), then step it with run_core() or
+//	 chip8_run_frame() on a core from init_core(). Keys are set with
+//	 chip8_set_key() and the display is read in place with chip8_framebuffer().
+//	 Machines running the same ROM can share its RAM: chip8_image_create() it
+//	 once and chip8_load_image() each machine, which copies only the pages it
+//	 writes. chip8_destroy() or chip8_unload() frees a machine's pages.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Emulation core used to run CHIP8 instructions
+typedef enum {
+	CORE_INTERPRETER,	// Predecoded interpreter (threaded or switch dispatch)
+	CORE_JIT,			// x86-64 dynamic recompiler, falls back to the interpreter
+	CORE_BLOCK,			// Cached block interpreter with superinstructions
+} core_t;
+
+// Behaviours that CHIP8 variants disagree on, one bit each
+enum {
+	QUIRK_VF_RESET	= 1 << 0,	// 8XY1/8XY2/8XY3 reset VF
+	QUIRK_SHIFT_VY	= 1 << 1,	// 8XY6/8XYE shift VY into VX, rather than VX in place
+	QUIRK_MEM_INC_I	= 1 << 2,	// FX55/FX65 leave I pointing past the last register
+	QUIRK_JUMP_VX	= 1 << 3,	// BXNN jumps to XNN + VX, rather than NNN + V0
+	QUIRK_WRAP		= 1 << 4,	// Sprites wrap around the screen edges, rather than clip
+};
+
+// Quirk profiles. Each is compiled into its own specialized handlers, see
+//	 CHIP8_PROFILES, so no instruction checks quirks at run time.
+typedef enum {
+	PROFILE_CHIP8,		// Original COSMAC VIP interpreter
+	PROFILE_SCHIP,		// SUPER-CHIP 1.1
+	PROFILE_XOCHIP,		// XO-CHIP
+	PROFILE_COUNT,
+} profile_t;
+
+#define QUIRKS_CHIP8	(QUIRK_VF_RESET | QUIRK_SHIFT_VY | QUIRK_MEM_INC_I)
+#define QUIRKS_SCHIP	(QUIRK_JUMP_VX)
+#define QUIRKS_XOCHIP	(QUIRK_SHIFT_VY | QUIRK_MEM_INC_I | QUIRK_WRAP)
+
+// X-macro over every profile: X(name, profile, quirks)
+#define CHIP8_PROFILES(X)					\
+	X(chip8, PROFILE_CHIP8, QUIRKS_CHIP8)		\
+	X(schip, PROFILE_SCHIP, QUIRKS_SCHIP)		\
+	X(xochip, PROFILE_XOCHIP, QUIRKS_XOCHIP)
+
+#define DEFAULT_INSTS_PER_SECOND 700	// Common CHIP8 clock rate
+
+// Machine configuration: what the emulation cores need to run instructions
+typedef struct {
+	core_t core;			// Emulation core to run instructions with
+	profile_t profile;		// Quirk profile of the CHIP8 variant to emulate
+	uint32_t insts_per_second;	// CHIP8 CPU clock rate, 0 = unlimited (timers count at the default rate)
+} chip8_config_t;
+
+// Emulator states
+typedef enum {
+	QUIT,
+	RUNNING,
+	PAUSED,
+} emulator_state_t;
+
+// CHIP8 Instruction type
+typedef struct {
+	uint16_t opcode;
+	uint16_t NNN;
+	uint8_t NN;
+	uint8_t N;
+	uint8_t X;
+	uint8_t Y;
+	uint8_t op;					// Handler index (opcode_t in libchip8.c)
+} instruction_t;
+
+#define CHIP8_DISPLAY_WIDTH 64		// Pixels per display row, one uint64_t
+#define CHIP8_DISPLAY_HEIGHT 32
+
+#define CHIP8_RAM_SIZE 4096
+#define CHIP8_PAGE_BITS 8			// RAM is shared and copied on write in pages of 256 bytes
+#define CHIP8_PAGE_SIZE (1 << CHIP8_PAGE_BITS)
+#define CHIP8_PAGE_MASK (CHIP8_PAGE_SIZE - 1)
+#define CHIP8_PAGES (CHIP8_RAM_SIZE / CHIP8_PAGE_SIZE)
+
+// RAM page and shared ROM image, see libchip8.c
+typedef struct chip8_page chip8_page_t;
+typedef struct chip8_image chip8_image_t;
+
+// CHIP8 Machine object
+// The machine state proper comes first and is position independent, so
+//	 snapshots are a plain copy of the leading CHIP8_STATE_SIZE bytes plus
+//	 RAM. Everything from state onwards is host side or derived from RAM.
+typedef struct {
+	uint64_t display[CHIP8_DISPLAY_HEIGHT];	// One row per word, MSB is leftmost pixel
+	uint16_t stack[16];
+	uint8_t stack_ptr;			// Index of next free stack entry, wraps at 16
+	uint8_t V[16];				// Data registers V0-VF
+	uint16_t I;					// Index Register
+	uint16_t PC;				// Program counter
+	uint8_t delay_timer;		// Value last set by FX15, counts down lazily from delay_cycle
+	uint8_t sound_timer;		// Value last set by FX18, counts down lazily from sound_cycle
+	uint64_t delay_cycle;		// Instruction that last set delay_timer (see timer_ticks)
+	uint64_t sound_cycle;		// Instruction that last set sound_timer
+	uint16_t keypad;			// Hexadecimal keypad 0x0-0xF, bit n set while key n is down
+	uint8_t key_wait;			// FX0A: key pressed and waiting to be released + 1, 0 if none
+	uint64_t cycles;			// Instructions executed since init
+	uint32_t rng;				// CXNN random number generator state (xorshift32), never 0
+
+	emulator_state_t state;		// First field not in snapshots
+	uint32_t dirty_rows;		// Display rows changed since last render (bit n = row n), 0 if none
+	uint32_t drawn_rows;		// Display rows changed since the last checkpoint (bit n = row n)
+	uint16_t written_pages;		// RAM pages written since the last checkpoint (bit p = page p)
+	const char *rom_name;		// Currently running ROM
+	bool ram_written;			// RAM written since last check (for translated code invalidation)
+	uint16_t ram_write_lo;		// Lowest RAM address written since last check
+	uint16_t ram_write_hi;		// Highest RAM address written since last check
+	instruction_t inst;			// Currently executing instruction (DEBUG builds only)
+	const chip8_image_t *image;	// ROM image pages are shared from until written
+	chip8_image_t *own_image;	// Image made by chip8_load_rom(), freed with the machine
+	const chip8_page_t *page[CHIP8_PAGES];	// RAM and its predecoded instructions: image's or own_page's
+	chip8_page_t *own_page[CHIP8_PAGES];	// Private copies made on first write, NULL until then
+} chip8_t;
+
+#define CHIP8_STATE_SIZE offsetof(chip8_t, state)
+#define CHIP8_SNAPSHOT_SIZE (CHIP8_STATE_SIZE + CHIP8_RAM_SIZE)	// State, then RAM
+
+// Machine state snapshot, see chip8_snapshot()/chip8_restore()
+typedef struct {
+	uint64_t data[(CHIP8_SNAPSHOT_SIZE + 7) / 8];
+} chip8_snapshot_t;
+
+// Keypad change at the instruction count it was applied at
+typedef struct {
+	uint64_t cycle;			// Instructions executed before the change
+	uint8_t key;			// CHIP8 key 0x0-0xF
+	bool down;
+} movie_event_t;
+
+// Input movie: every keypad change of a run, plus what else is needed to
+//	 replay it deterministically and check that it did
+typedef struct {
+	uint64_t rom_hash;			// FNV-1a of RAM after init, identifies the ROM
+	uint32_t seed;				// CXNN random seed
+	uint32_t insts_per_second;	// Instruction rate, which timers count in
+	uint8_t profile;			// Quirk profile (profile_t)
+	movie_event_t *events;
+	uint32_t count;
+	uint32_t capacity;
+	uint64_t final_cycles;		// Instructions executed when recording ended
+	uint64_t state_hash;		// hash_state() when recording ended
+	uint64_t framebuffer_hash;	// hash_framebuffer() when recording ended
+} movie_t;
+
+// Caches of the block and JIT cores, the rewind buffer and batched
+//	 environments; see libchip8.c
+typedef struct block_cache block_cache_t;
+typedef struct jit jit_t;
+typedef struct rewind rewind_t;
+typedef struct chip8_envs chip8_envs_t;
+
+// Emulation core selected by config.core, with its caches
+typedef struct {
+	jit_t *jit;					// NULL unless running on the JIT core
+	block_cache_t *block_cache;	// NULL unless running on the block core
+} core_state_t;
+
+// Many instances of one ROM, one array entry per lane for each part of the
+//	 machine state of chip8_t. Set keys with keypad[lane], read results with
+//	 chip8_batch_get().
+typedef struct {
+	uint32_t count;				// Instances (lanes)
+	uint32_t stride;			// Entries per lane array: count padded for whole vectors
+	uint8_t *V[16];				// V[x][lane]
+	uint16_t *I;
+	uint16_t *PC;
+	uint16_t *stack[16];		// stack[depth][lane]
+	uint8_t *stack_ptr;
+	uint64_t *display[CHIP8_DISPLAY_HEIGHT];	// display[row][lane], as chip8_t.display
+	uint8_t *delay_timer;
+	uint8_t *sound_timer;
+	uint64_t *delay_cycle;
+	uint64_t *sound_cycle;
+	uint16_t *keypad;
+	uint8_t *key_wait;
+	uint32_t *rng;
+	uint64_t *idle;				// Steps the lane sat out; its cycles are steps - idle
+	uint64_t *target;			// Cycles the lane stops at in chip8_batch_run()
+	uint8_t *mask;				// Lanes in the group running the current step
+	uint8_t *group;				// Scratch mask for splitting a group
+	uint8_t *cond;				// Per lane branch outcome of the current step
+	uint8_t **ram_page;			// ram_page[lane * CHIP8_PAGES + p]: into image until the lane writes page p
+	void *lanes;				// Allocation backing every lane array
+	uint64_t steps;				// Instructions run by some group so far
+	uint8_t image[CHIP8_RAM_SIZE];	// RAM every lane started from
+	uint8_t written[CHIP8_RAM_SIZE / 8];	// Bit per address some lane wrote a byte other than image's to
+	instruction_t decoded[CHIP8_RAM_SIZE];	// Predecoded image, valid unless written covers the address
+} chip8_batch_t;
+
+#define FNV1A_INIT 0xCBF29CE484222325ull
+
+// Error reporting: messages go to log, or to stderr if it is NULL
+typedef void (*chip8_log_t)(const char *message);
+void chip8_set_log(chip8_log_t log);
+
+// Machine
+chip8_t *chip8_create(void);
+void chip8_destroy(chip8_t *chip8);
+chip8_image_t *chip8_image_create(const uint8_t *rom, const size_t size);
+void chip8_image_destroy(chip8_image_t *image);
+void chip8_load_image(chip8_t *chip8, const chip8_image_t *image);
+bool chip8_load_rom(chip8_t *chip8, const uint8_t *rom, const size_t size);
+void chip8_unload(chip8_t *chip8);
+uint8_t chip8_read_ram(const chip8_t *chip8, const uint16_t addr);
+bool init_chip8(chip8_t *chip8, const char *rom_name);
+void seed_chip8(chip8_t *chip8, const uint32_t seed);
+void chip8_set_key(chip8_t *chip8, const uint8_t key, const bool down);
+const uint64_t *chip8_framebuffer(const chip8_t *chip8);
+bool chip8_is_idle(const chip8_t *chip8);
+bool sound_playing(const chip8_t *chip8, const chip8_config_t *config);
+void sound_span(const chip8_t *chip8, const chip8_config_t *config, uint64_t *start, uint64_t *stop);
+
+// Snapshots, save states and rewind
+void chip8_snapshot(const chip8_t *chip8, chip8_snapshot_t *snapshot);
+void chip8_restore(chip8_t *chip8, const chip8_snapshot_t *snapshot);
+void chip8_checkpoint(chip8_t *chip8, chip8_snapshot_t *checkpoint);
+void chip8_reset(chip8_t *chip8, const chip8_snapshot_t *checkpoint);
+bool save_state(const chip8_t *chip8, const char *path);
+bool load_state(chip8_t *chip8, const char *path);
+rewind_t *rewind_create(const uint32_t arena_size);
+void rewind_destroy(rewind_t *rewind);
+void rewind_push(rewind_t *rewind, const chip8_t *chip8);
+bool rewind_pop(rewind_t *rewind, chip8_t *chip8);
+
+// Running instructions
+void emulate_instruction(chip8_t *chip8, const chip8_config_t config);
+void run_instructions(chip8_t *chip8, const chip8_config_t config, uint64_t count);
+bool init_core(core_state_t *core, const chip8_config_t config);
+void destroy_core(core_state_t *core);
+void run_core(core_state_t *core, chip8_t *chip8, const chip8_config_t config, const uint64_t count);
+const char *core_name(const core_state_t *core);
+uint64_t instructions_this_frame(const chip8_config_t config, uint32_t *remainder);
+void chip8_run_frame(core_state_t *core, chip8_t *chip8, const chip8_config_t config);
+
+// Lockstep batch core
+chip8_batch_t *chip8_batch_create(const chip8_t *chip8, const uint32_t count);
+void chip8_batch_destroy(chip8_batch_t *batch);
+void chip8_batch_set(chip8_batch_t *batch, const uint32_t lane, const chip8_t *chip8);
+void chip8_batch_get(const chip8_batch_t *batch, const uint32_t lane, chip8_t *chip8);
+void chip8_batch_run(chip8_batch_t *batch, const chip8_config_t config, const uint64_t count);
+const char *chip8_batch_isa(void);
+
+// Hashes
+uint64_t fnv1a(uint64_t hash, const void *data, const size_t len);
+uint64_t hash_ram(const chip8_t *chip8);
+uint64_t hash_framebuffer(const chip8_t *chip8);
+uint64_t hash_state(const chip8_t *chip8);
+
+// Input movies
+bool movie_record(movie_t *movie, const uint64_t cycle, const uint8_t key, const bool down);
+void movie_truncate(movie_t *movie, const uint64_t cycle);
+bool movie_save(const movie_t *movie, const char *path);
+bool movie_load(movie_t *movie, const char *path);
+
+// Batched environments for reinforcement learning
+chip8_envs_t *chip8_envs_create(const uint8_t *rom, const size_t size, const uint32_t count,
+								const chip8_config_t config, const uint32_t seed,
+								const uint16_t reward_addr, const uint32_t threads);
+void chip8_envs_destroy(chip8_envs_t *envs);
+void chip8_envs_reset(chip8_envs_t *envs, const uint8_t *mask);
+void chip8_envs_step(chip8_envs_t *envs, const uint16_t *actions, const uint32_t frames_per_step,
+					 uint64_t *framebuffers, uint8_t *rewards);
+chip8_t *chip8_envs_machine(chip8_envs_t *envs, const uint32_t i);
+uint32_t chip8_cpu_count(void);
+
+#endif
@@ -0,0 +1,3860 @@
+#define _DEFAULT_SOURCE		// MAP_ANONYMOUS and friends under -std=c17
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+// Lockstep batch core vector unit
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Batched environments' thread pool and CPU count
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "chip8.h"
+
+static chip8_log_t log_message;	// Set by chip8_set_log(), NULL for stderr
+
+void chip8_set_log(chip8_log_t log) {
+	log_message = log;
+}
+
+// Report an error through the log function set by the library's user
+static void chip8_log(const char *format, ...) {
+	char message[1024];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(message, sizeof message, format, args);
+	va_end(args);
+
+	if (log_message) log_message(message);
+	else fputs(message, stderr);
+}
+
+// CHIP8 decoded operation; index of the handler that emulates an instruction
+typedef enum {
+	OP_INVALID,		// Unimplemented/invalid opcode
+	OP_CLS,			// 00E0
+	OP_RET,			// 00EE
+	OP_JP,			// 1NNN
+	OP_JP_SELF,		// 1NNN jumping to itself: idle loop
+	OP_JP_WAIT,		// 1NNN jumping back 2 instructions: possible FX07/3X00 timer wait loop
+	OP_CALL,		// 2NNN
+	OP_SE_VX_NN,	// 3XNN
+	OP_SNE_VX_NN,	// 4XNN
+	OP_SE_VX_VY,	// 5XY0
+	OP_LD_VX_NN,	// 6XNN
+	OP_ADD_VX_NN,	// 7XNN
+	OP_LD_VX_VY,	// 8XY0
+	OP_OR,			// 8XY1
+	OP_AND,			// 8XY2
+	OP_XOR,			// 8XY3
+	OP_ADD_VX_VY,	// 8XY4
+	OP_SUB,			// 8XY5
+	OP_SHR,			// 8XY6
+	OP_SUBN,		// 8XY7
+	OP_SHL,			// 8XYE
+	OP_SNE_VX_VY,	// 9XY0
+	OP_LD_I_NNN,	// ANNN
+	OP_JP_V0,		// BNNN
+	OP_RND,			// CXNN
+	OP_DRW,			// DXYN
+	OP_SKP,			// EX9E
+	OP_SKNP,		// EXA1
+	OP_LD_VX_DT,	// FX07
+	OP_LD_VX_K,		// FX0A
+	OP_LD_DT_VX,	// FX15
+	OP_LD_ST_VX,	// FX18
+	OP_ADD_I_VX,	// FX1E
+	OP_LD_F_VX,		// FX29
+	OP_LD_B_VX,		// FX33
+	OP_LD_I_VX,		// FX55
+	OP_LD_VX_I,		// FX65
+	OP_COUNT,
+} opcode_t;
+
+// Decode a raw opcode into its handler index and pre-split operands
+static instruction_t decode_instruction(const uint16_t opcode) {
+	instruction_t inst = {
+		.opcode = opcode,
+		.NNN = opcode & 0x0FFF,
+		.NN = opcode & 0x0FF,
+		.N = opcode & 0x0F,
+		.X = (opcode >> 8) & 0x0F,
+		.Y = (opcode >> 4) & 0x0F,
+		.op = OP_INVALID,
+	};
+
+	// 8XY_ ALU group, indexed by N
+	static const uint8_t alu_ops[16] = {
+		[0x0] = OP_LD_VX_VY, [0x1] = OP_OR, [0x2] = OP_AND, [0x3] = OP_XOR,
+		[0x4] = OP_ADD_VX_VY, [0x5] = OP_SUB, [0x6] = OP_SHR, [0x7] = OP_SUBN,
+		[0xE] = OP_SHL,
+	};
+
+	switch ((opcode >> 12) & 0x0F) {
+	case 0x0:
+		if (inst.NN == 0xE0) inst.op = OP_CLS;
+		else if (inst.NN == 0xEE) inst.op = OP_RET;
+		break;
+
+	case 0x01: inst.op = OP_JP; break;
+	case 0x02: inst.op = OP_CALL; break;
+	case 0x03: inst.op = OP_SE_VX_NN; break;
+	case 0x04: inst.op = OP_SNE_VX_NN; break;
+	case 0x05: if (inst.N == 0) inst.op = OP_SE_VX_VY; break;
+	case 0x06: inst.op = OP_LD_VX_NN; break;
+	case 0x07: inst.op = OP_ADD_VX_NN; break;
+	case 0x08: inst.op = alu_ops[inst.N]; break;
+	case 0x09: if (inst.N == 0) inst.op = OP_SNE_VX_VY; break;
+	case 0x0A: inst.op = OP_LD_I_NNN; break;
+	case 0x0B: inst.op = OP_JP_V0; break;
+	case 0x0C: inst.op = OP_RND; break;
+	case 0x0D: inst.op = OP_DRW; break;
+
+	case 0x0E:
+		if (inst.NN == 0x9E) inst.op = OP_SKP;
+		else if (inst.NN == 0xA1) inst.op = OP_SKNP;
+		break;
+
+	case 0x0F:
+		switch (inst.NN) {
+		case 0x07: inst.op = OP_LD_VX_DT; break;
+		case 0x0A: inst.op = OP_LD_VX_K; break;
+		case 0x15: inst.op = OP_LD_DT_VX; break;
+		case 0x18: inst.op = OP_LD_ST_VX; break;
+		case 0x1E: inst.op = OP_ADD_I_VX; break;
+		case 0x29: inst.op = OP_LD_F_VX; break;
+		case 0x33: inst.op = OP_LD_B_VX; break;
+		case 0x55: inst.op = OP_LD_I_VX; break;
+		case 0x65: inst.op = OP_LD_VX_I; break;
+		default: break;
+		}
+		break;
+
+	default:
+		break; // Unimplemented/invalid
+	}
+
+	return inst;
+}
+
+// Predecoded instruction starting at addr, given the two RAM bytes there
+static instruction_t predecode(const uint16_t addr, const uint8_t hi, const uint8_t lo) {
+	instruction_t inst = decode_instruction((hi << 8) | lo);
+
+	// A jump to its own address is an idle loop the runners can fast-forward.
+	//	 A jump back 2 instructions may close an FX07/3X00 delay timer wait,
+	//	 checked when it runs since the loop body may change independently.
+	if (inst.op == OP_JP && inst.NNN == addr) {
+		inst.op = OP_JP_SELF;
+	} else if (inst.op == OP_JP && inst.NNN + 4 == addr) {
+		inst.op = OP_JP_WAIT;
+	}
+	return inst;
+}
+
+// RAM page: bytes and the predecoded instruction starting at each of them.
+//	 The last instruction also depends on the next page's first byte.
+struct chip8_page {
+	uint8_t ram[CHIP8_PAGE_SIZE];
+	instruction_t decoded[CHIP8_PAGE_SIZE];
+	uint64_t id;			// Unique to these contents, see chip8_page_id()
+};
+
+// Ids are never reused, not even across machines or images, so code cached
+//	 from a page is valid for any machine whose page still has the same id.
+//	 A page gets a new one whenever it is filled from somewhere else; writes
+//	 to a machine's own page keep it, and are tracked with track_ram_write().
+static uint64_t chip8_page_id(void) {
+	static atomic_uint_fast64_t next_id = 1;	// 0 is never a page's
+	return atomic_fetch_add(&next_id, 1);
+}
+
+// ROM image: font and ROM loaded and predecoded once, then shared read-only
+//	 by every machine running it until each writes its own copy of a page
+struct chip8_image {
+	chip8_page_t pages[CHIP8_PAGES];
+};
+
+static inline uint8_t chip8_ram(const chip8_t *chip8, const uint16_t addr) {
+	return chip8->page[addr >> CHIP8_PAGE_BITS]->ram[addr & CHIP8_PAGE_MASK];
+}
+
+static inline const instruction_t *chip8_decoded(const chip8_t *chip8, const uint16_t addr) {
+	return &chip8->page[addr >> CHIP8_PAGE_BITS]->decoded[addr & CHIP8_PAGE_MASK];
+}
+
+// Page p made writable: copied from the shared image on first write. A copy
+//	 is kept for reuse when a restore points the page back at the image.
+static chip8_page_t *chip8_own_page(chip8_t *chip8, const uint8_t p) {
+	chip8_page_t *page = chip8->own_page[p];
+	if (chip8->page[p] == page) return page;
+
+	if (!page) {
+		page = malloc(sizeof *page);
+		if (!page) {
+			chip8_log("Could not allocate memory for a RAM page\n");
+			abort();
+		}
+		chip8->own_page[p] = page;
+	}
+	memcpy(page, chip8->page[p], sizeof *page);
+	page->id = chip8_page_id();
+	chip8->page[p] = page;
+	return page;
+}
+
+// Refresh the predecoded instruction starting at addr from current RAM contents
+static void predecode_address(chip8_t *chip8, const uint16_t addr) {
+	const uint8_t lo = (addr + 1u < CHIP8_RAM_SIZE) ? chip8_ram(chip8, addr + 1) : 0;
+	const instruction_t inst = predecode(addr, chip8_ram(chip8, addr), lo);
+
+	// Same opcode at the same address decodes the same: leave shared pages be
+	if (chip8_decoded(chip8, addr)->opcode == inst.opcode) return;
+	chip8_own_page(chip8, addr >> CHIP8_PAGE_BITS)->decoded[addr & CHIP8_PAGE_MASK] = inst;
+}
+
+// Write a byte to RAM; both instructions overlapping that byte are re-decoded
+// Track written RAM range so translated code covering it can be dropped
+static void track_ram_write(chip8_t *chip8, const uint16_t lo, const uint16_t hi) {
+	if (!chip8->ram_written) {
+		chip8->ram_written = true;
+		chip8->ram_write_lo = lo;
+		chip8->ram_write_hi = hi;
+	} else {
+		if (lo < chip8->ram_write_lo) chip8->ram_write_lo = lo;
+		if (hi > chip8->ram_write_hi) chip8->ram_write_hi = hi;
+	}
+}
+
+static void write_ram(chip8_t *chip8, uint16_t addr, const uint8_t value) {
+	addr &= 0x0FFF;
+	if (chip8_ram(chip8, addr) == value) return;	// Nothing to copy, re-decode or invalidate
+
+	chip8_own_page(chip8, addr >> CHIP8_PAGE_BITS)->ram[addr & CHIP8_PAGE_MASK] = value;
+	chip8->written_pages |= 1u << (addr >> CHIP8_PAGE_BITS);
+	predecode_address(chip8, addr);
+	if (addr > 0) predecode_address(chip8, addr - 1);
+	track_ram_write(chip8, addr, addr);
+}
+
+// Seed the CXNN random number generator
+void seed_chip8(chip8_t *chip8, const uint32_t seed) {
+	chip8->rng = seed ? seed : 0x2545F491;	// xorshift32 must not start at 0
+}
+
+#define CHIP8_ENTRY_POINT 0x200		// Where ROMs are loaded and start running
+
+// Allocate a machine, to be loaded with chip8_load_rom() or chip8_load_image()
+chip8_t *chip8_create(void) {
+	return calloc(1, sizeof(chip8_t));
+}
+
+void chip8_destroy(chip8_t *chip8) {
+	if (!chip8) return;
+	chip8_unload(chip8);
+	free(chip8);
+}
+
+// Font and ROM loaded and predecoded into an image, to be shared by any
+//	 number of machines with chip8_load_image(). NULL if the ROM is too big.
+chip8_image_t *chip8_image_create(const uint8_t *rom, const size_t size) {
+	const uint8_t font[] = {
+		0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+		0x20, 0x60, 0x20, 0x20, 0x70, // 1
+		0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+		0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+		0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+		0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+		0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+		0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+		0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+		0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+		0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+		0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+		0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+		0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+		0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+		0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+	};
+
+	const size_t max_size = CHIP8_RAM_SIZE - CHIP8_ENTRY_POINT;
+	if (size > max_size) {
+		chip8_log("Rom is too big. Rom size: %lu; Max size allowed: %lu.\n", (unsigned long)size, (unsigned long)max_size);
+		return NULL;
+	}
+
+	chip8_image_t *image = calloc(1, sizeof *image);
+	if (!image) {
+		chip8_log("Could not allocate memory for a ROM image\n");
+		return NULL;
+	}
+
+	// Load font and ROM
+	uint8_t ram[CHIP8_RAM_SIZE] = {0};
+	memcpy(&ram[0], font, sizeof(font));
+	if (size) memcpy(&ram[CHIP8_ENTRY_POINT], rom, size);
+
+	// Predecode every RAM address so the emulation loop never decodes
+	for (uint16_t addr = 0; addr < CHIP8_RAM_SIZE; addr++) {
+		chip8_page_t *page = &image->pages[addr >> CHIP8_PAGE_BITS];
+		page->ram[addr & CHIP8_PAGE_MASK] = ram[addr];
+		page->decoded[addr & CHIP8_PAGE_MASK] = predecode(addr, ram[addr], addr + 1u < CHIP8_RAM_SIZE ? ram[addr + 1] : 0);
+	}
+	for (uint8_t p = 0; p < CHIP8_PAGES; p++) image->pages[p].id = chip8_page_id();
+
+	return image;
+}
+
+// Free an image no machine is loaded with any longer
+void chip8_image_destroy(chip8_image_t *image) {
+	free(image);
+}
+
+// Reset the machine to power on state with an image loaded. The image must
+//	 outlive the machine, or its next load.
+void chip8_load_image(chip8_t *chip8, const chip8_image_t *image) {
+	chip8_unload(chip8);
+	memset(chip8, 0, sizeof *chip8);
+
+	chip8->image = image;
+	for (uint8_t p = 0; p < CHIP8_PAGES; p++) chip8->page[p] = &image->pages[p];
+
+	// Set chip8 machine defaults
+	chip8->state = RUNNING;
+	chip8->PC = CHIP8_ENTRY_POINT;
+	chip8->stack_ptr = 0;
+	seed_chip8(chip8, 0);
+	chip8->dirty_rows = 0xFFFFFFFF;	// Draw whole screen on first frame
+	chip8->drawn_rows = 0xFFFFFFFF;	// Nothing left of an earlier checkpoint
+	chip8->written_pages = 0xFFFF;
+	track_ram_write(chip8, 0, CHIP8_RAM_SIZE - 1);	// Cores' caches hold the last image's code
+}
+
+// Reset the machine to power on state with a ROM image from memory loaded
+bool chip8_load_rom(chip8_t *chip8, const uint8_t *rom, const size_t size) {
+	chip8_image_t *image = chip8_image_create(rom, size);
+	if (!image) return false;
+
+	chip8_load_image(chip8, image);
+	chip8->own_image = image;
+	return true;
+}
+
+// Free the machine's RAM pages, and its image if chip8_load_rom() made it
+void chip8_unload(chip8_t *chip8) {
+	for (uint8_t p = 0; p < CHIP8_PAGES; p++) {
+		free(chip8->own_page[p]);
+		chip8->own_page[p] = NULL;
+		chip8->page[p] = NULL;
+	}
+	chip8_image_destroy(chip8->own_image);
+	chip8->own_image = NULL;
+	chip8->image = NULL;
+}
+
+// RAM byte at addr, for embedders reading game state such as a score
+uint8_t chip8_read_ram(const chip8_t *chip8, const uint16_t addr) {
+	return chip8_ram(chip8, addr & 0x0FFF);
+}
+
+// Initialize CHIP8 machine from a ROM file
+bool init_chip8(chip8_t *chip8, const char *rom_name) {
+	uint8_t buffer[CHIP8_RAM_SIZE - CHIP8_ENTRY_POINT];
+
+	FILE *rom = fopen(rom_name, "rb");
+	if (!rom) {
+		chip8_log("Rom file %s is corrupted or does not exist.\n", rom_name);
+		return false;
+	}
+
+	// Get/check rom size
+	fseek(rom, 0, SEEK_END);
+	const size_t rom_size = ftell(rom);
+	const size_t max_size = sizeof buffer;
+	rewind(rom);
+
+	if (rom_size > max_size) {
+		chip8_log("Rom file %s is too big. Rom size: %lu; Max size allowed: %lu.\n", rom_name, (unsigned long)rom_size, (unsigned long)max_size);
+		fclose(rom);
+		return false;
+	}
+
+	const bool read = (fread(buffer, rom_size, 1, rom) == 1);
+	fclose(rom);
+	if (!read) {
+		chip8_log("Could not read Rom file %s into CHIP8 memory\n", rom_name);
+		return false;
+	}
+
+	if (!chip8_load_rom(chip8, buffer, rom_size)) return false;
+	chip8->rom_name = rom_name;
+	return true;
+}
+
+// Press (down) or release a keypad key, 0x0-0xF
+void chip8_set_key(chip8_t *chip8, const uint8_t key, const bool down) {
+	if (down) chip8->keypad |= (uint16_t)(1u << (key & 0x0F));
+	else chip8->keypad &= (uint16_t)~(1u << (key & 0x0F));
+}
+
+// The display in place: 32 rows of 64 pixels, one row per word, MSB is the
+//	 leftmost pixel. Rows changed since the last render are in dirty_rows.
+const uint64_t *chip8_framebuffer(const chip8_t *chip8) {
+	return chip8->display;
+}
+
+// Take a snapshot of the machine state: a memcpy of the state, then RAM
+//	 gathered from its pages
+void chip8_snapshot(const chip8_t *chip8, chip8_snapshot_t *snapshot) {
+	uint8_t *data = (uint8_t *)snapshot->data;
+	memcpy(data, chip8, CHIP8_STATE_SIZE);
+	for (uint8_t p = 0; p < CHIP8_PAGES; p++) {
+		memcpy(data + CHIP8_STATE_SIZE + p * CHIP8_PAGE_SIZE, chip8->page[p]->ram, CHIP8_PAGE_SIZE);
+	}
+}
+
+// Restore RAM page p to saved, if it differs. Returns whether it did.
+//	 A page restored to the image's contents shares the image again.
+static bool restore_page(chip8_t *chip8, const uint8_t p, const uint8_t *saved) {
+	const uint16_t start = p * CHIP8_PAGE_SIZE;
+	if (memcmp(chip8->page[p]->ram, saved, CHIP8_PAGE_SIZE) == 0) return false;
+
+	// The image's page, if its last instruction also decodes the same
+	const chip8_page_t *shared = &chip8->image->pages[p];
+	const bool next_shared = p + 1 == CHIP8_PAGES || saved[CHIP8_PAGE_SIZE] == shared[1].ram[0];
+	if (next_shared && memcmp(shared->ram, saved, CHIP8_PAGE_SIZE) == 0) {
+		chip8->page[p] = shared;
+	} else {
+		chip8_page_t *page = chip8_own_page(chip8, p);
+		memcpy(page->ram, saved, CHIP8_PAGE_SIZE);
+		for (uint16_t addr = start; addr < start + CHIP8_PAGE_SIZE; addr++) {
+			const uint8_t lo = (addr + 1u < CHIP8_RAM_SIZE) ? chip8_ram(chip8, addr + 1) : 0;
+			page->decoded[addr - start] = predecode(addr, page->ram[addr - start], lo);
+		}
+		page->id = chip8_page_id();
+	}
+
+	// The instruction straddling the page start
+	if (start) predecode_address(chip8, start - 1);
+	track_ram_write(chip8, start, start + CHIP8_PAGE_SIZE - 1);
+	chip8->written_pages |= 1u << p;
+	return true;
+}
+
+// Restore the machine state from a snapshot, which may come from another
+//	 instance of the same ROM. Only RAM pages that differ are re-predecoded
+//	 and reported to the cores' caches, and only display rows that differ
+//	 redrawn, so restoring costs little more than the copy itself.
+void chip8_restore(chip8_t *chip8, const chip8_snapshot_t *snapshot) {
+	const uint8_t *saved = (const uint8_t *)snapshot->data;
+	const uint8_t *ram = saved + CHIP8_STATE_SIZE;
+	const uint8_t *display = saved + offsetof(chip8_t, display);
+
+	for (uint32_t row = 0; row < 32; row++) {
+		if (memcmp(&chip8->display[row], display + row * sizeof(uint64_t), sizeof(uint64_t)) != 0) {
+			chip8->dirty_rows |= 1u << row;
+			chip8->drawn_rows |= 1u << row;
+		}
+	}
+
+	for (uint8_t p = 0; p < CHIP8_PAGES; p++) restore_page(chip8, p, &ram[p * CHIP8_PAGE_SIZE]);
+
+	memcpy(chip8, snapshot->data, CHIP8_STATE_SIZE);
+}
+
+// Take a snapshot to go back to with chip8_reset(), and track the RAM pages
+//	 and display rows changed from here on
+void chip8_checkpoint(chip8_t *chip8, chip8_snapshot_t *checkpoint) {
+	chip8_snapshot(chip8, checkpoint);
+	chip8->drawn_rows = 0;
+	chip8->written_pages = 0;
+}
+
+// Go back to the machine's last checkpoint. Only RAM pages written and
+//	 display rows drawn since are copied back, so a reset after a short run
+//	 costs little more than the registers; pages matching the ROM image share
+//	 it again without a copy.
+void chip8_reset(chip8_t *chip8, const chip8_snapshot_t *checkpoint) {
+	const uint8_t *saved = (const uint8_t *)checkpoint->data;
+	const uint8_t *ram = saved + CHIP8_STATE_SIZE;
+	const uint64_t *display = (const uint64_t *)(saved + offsetof(chip8_t, display));
+
+	for (uint8_t p = 0; p < CHIP8_PAGES; p++) {
+		if (chip8->written_pages & (1u << p)) restore_page(chip8, p, &ram[p * CHIP8_PAGE_SIZE]);
+	}
+	for (uint32_t row = 0; row < 32; row++) {
+		if (chip8->drawn_rows & (1u << row)) chip8->display[row] = display[row];
+	}
+	chip8->dirty_rows |= chip8->drawn_rows;
+
+	// Everything else in a snapshot is registers: copied whole
+	const size_t registers = offsetof(chip8_t, display) + sizeof chip8->display;
+	memcpy((uint8_t *)chip8 + registers, saved + registers, CHIP8_STATE_SIZE - registers);
+
+	chip8->drawn_rows = 0;
+	chip8->written_pages = 0;
+}
+
+// Save state file format, version 2. All values little endian:
+//	 "C8ST", u16 version, ram[4096], u64 display[32], u16 stack[16],
+//	 u8 stack_ptr, V[16], u16 I, u16 PC, u8 delay_timer, u8 sound_timer,
+//	 u64 delay_cycle, u64 sound_cycle, u16 keypad, u8 key_wait, u64 cycles,
+//	 u32 rng (version 2)
+#define SAVE_STATE_MAGIC "C8ST"
+#define SAVE_STATE_VERSION 2
+#define SAVE_STATE_SIZE (4 + 2 + 4096 + 32 * 8 + 16 * 2 + 1 + 16 + 2 + 2 + 1 + 1 + 8 + 8 + 2 + 1 + 8 + 4)
+
+static uint8_t *put_le(uint8_t *p, uint64_t value, const uint8_t bytes) {
+	for (uint8_t i = 0; i < bytes; i++, value >>= 8) *p++ = (uint8_t)value;
+	return p;
+}
+
+static const uint8_t *get_le(const uint8_t *p, uint64_t *value, const uint8_t bytes) {
+	*value = 0;
+	for (uint8_t i = 0; i < bytes; i++) *value |= (uint64_t)*p++ << (8 * i);
+	return p;
+}
+
+// Write machine state to a save state file
+bool save_state(const chip8_t *chip8, const char *path) {
+	uint8_t buffer[SAVE_STATE_SIZE];
+	uint8_t *p = buffer;
+
+	memcpy(p, SAVE_STATE_MAGIC, 4);
+	p = put_le(p + 4, SAVE_STATE_VERSION, 2);
+	for (uint8_t page = 0; page < CHIP8_PAGES; page++, p += CHIP8_PAGE_SIZE) {
+		memcpy(p, chip8->page[page]->ram, CHIP8_PAGE_SIZE);
+	}
+	for (uint8_t i = 0; i < 32; i++) p = put_le(p, chip8->display[i], 8);
+	for (uint8_t i = 0; i < 16; i++) p = put_le(p, chip8->stack[i], 2);
+	p = put_le(p, chip8->stack_ptr, 1);
+	memcpy(p, chip8->V, sizeof chip8->V);
+	p += sizeof chip8->V;
+	p = put_le(p, chip8->I, 2);
+	p = put_le(p, chip8->PC, 2);
+	p = put_le(p, chip8->delay_timer, 1);
+	p = put_le(p, chip8->sound_timer, 1);
+	p = put_le(p, chip8->delay_cycle, 8);
+	p = put_le(p, chip8->sound_cycle, 8);
+	p = put_le(p, chip8->keypad, 2);
+	p = put_le(p, chip8->key_wait, 1);
+	p = put_le(p, chip8->cycles, 8);
+	p = put_le(p, chip8->rng, 4);
+
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		chip8_log("Could not open save state %s for writing\n", path);
+		return false;
+	}
+
+	const bool written = (fwrite(buffer, sizeof buffer, 1, file) == 1);
+	if (fclose(file) != 0 || !written) {
+		chip8_log("Could not write save state %s\n", path);
+		return false;
+	}
+
+	return true;
+}
+
+// Read machine state from a save state file, leaving the machine untouched on failure
+bool load_state(chip8_t *chip8, const char *path) {
+	uint8_t buffer[SAVE_STATE_SIZE + 1];
+
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		chip8_log("Save state %s does not exist\n", path);
+		return false;
+	}
+
+	const size_t size = fread(buffer, 1, sizeof buffer, file);
+	fclose(file);
+
+	uint64_t version = 0;
+	if (size >= 6) get_le(buffer + 4, &version, 2);
+	if (size < 6 || memcmp(buffer, SAVE_STATE_MAGIC, 4) != 0 || version != SAVE_STATE_VERSION || size != SAVE_STATE_SIZE) {
+		chip8_log("Save state %s is corrupted or from an unsupported version\n", path);
+		return false;
+	}
+
+	// Rebuild the machine state as a snapshot, then restore it
+	chip8_snapshot_t snapshot;
+	chip8_t loaded = {0};
+	const uint8_t *p = buffer + 6;
+	uint64_t value;
+
+	memcpy((uint8_t *)snapshot.data + CHIP8_STATE_SIZE, p, CHIP8_RAM_SIZE);
+	p += CHIP8_RAM_SIZE;
+	for (uint8_t i = 0; i < 32; i++) p = get_le(p, &loaded.display[i], 8);
+	for (uint8_t i = 0; i < 16; i++) { p = get_le(p, &value, 2); loaded.stack[i] = value; }
+	p = get_le(p, &value, 1); loaded.stack_ptr = value;
+	memcpy(loaded.V, p, sizeof loaded.V);
+	p += sizeof loaded.V;
+	p = get_le(p, &value, 2); loaded.I = value;
+	p = get_le(p, &value, 2); loaded.PC = value;
+	p = get_le(p, &value, 1); loaded.delay_timer = value;
+	p = get_le(p, &value, 1); loaded.sound_timer = value;
+	p = get_le(p, &loaded.delay_cycle, 8);
+	p = get_le(p, &loaded.sound_cycle, 8);
+	p = get_le(p, &value, 2); loaded.keypad = value;
+	p = get_le(p, &value, 1); loaded.key_wait = value;
+	p = get_le(p, &loaded.cycles, 8);
+	p = get_le(p, &value, 4); loaded.rng = value;
+
+	memcpy(snapshot.data, &loaded, CHIP8_STATE_SIZE);
+	chip8_restore(chip8, &snapshot);
+
+	return true;
+}
+
+// Rewind buffer
+// A ring of per-frame snapshots. Every REWIND_KEYFRAME_INTERVAL frames a
+//	 keyframe is stored, and each frame in between stores only its XOR delta
+//	 against that keyframe. Entries are run-length encoded as alternating
+//	 runs of unchanged bytes and changed bytes, so a typical frame costs tens
+//	 of bytes. Encoded entries live in a circular byte arena allocated up
+//	 front; pushing a frame evicts the oldest keyframe group it overwrites,
+//	 and never allocates.
+#define REWIND_KEYFRAME_INTERVAL 60		// Frames per keyframe
+#define REWIND_MAX_FRAMES (60 * 60 * 30)	// Entries kept at most: 30 minutes at 60hz
+#define REWIND_MAX_ENCODED (CHIP8_SNAPSHOT_SIZE * 2 + 16)	// Worst case encoded snapshot
+
+// Encoded frame in the arena
+typedef struct {
+	uint32_t offset;		// Start in arena
+	uint32_t size;			// Encoded bytes
+	uint16_t group_pos;		// Frames since this frame's keyframe, 0 for a keyframe
+} rewind_entry_t;
+
+struct rewind {
+	uint8_t *arena;
+	uint32_t arena_size;
+	uint32_t write_pos;				// Arena offset just past the newest entry
+	rewind_entry_t *entries;		// Ring of REWIND_MAX_FRAMES entries
+	uint32_t oldest;				// Ring index of the oldest entry
+	uint32_t count;					// Entries held
+	chip8_snapshot_t keyframe;		// Decoded keyframe of the newest entry's group
+	chip8_snapshot_t frame;			// Scratch: frame being encoded or decoded
+	uint8_t encoded[REWIND_MAX_ENCODED];	// Scratch: encoded frame before it is placed
+};
+
+rewind_t *rewind_create(const uint32_t arena_size) {
+	rewind_t *rewind = calloc(1, sizeof *rewind);
+	if (!rewind) return NULL;
+
+	rewind->arena = malloc(arena_size);
+	rewind->entries = malloc(REWIND_MAX_FRAMES * sizeof *rewind->entries);
+	rewind->arena_size = arena_size;
+	if (!rewind->arena || !rewind->entries || arena_size < REWIND_MAX_ENCODED) {
+		free(rewind->arena);
+		free(rewind->entries);
+		free(rewind);
+		return NULL;
+	}
+
+	return rewind;
+}
+
+void rewind_destroy(rewind_t *rewind) {
+	if (!rewind) return;
+	free(rewind->arena);
+	free(rewind->entries);
+	free(rewind);
+}
+
+static uint8_t *put_varint(uint8_t *p, uint64_t value) {
+	for (; value >= 0x80; value >>= 7) *p++ = (uint8_t)(value | 0x80);
+	*p++ = (uint8_t)value;
+	return p;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, uint64_t *value) {
+	*value = 0;
+	for (uint8_t shift = 0; ; shift += 7) {
+		const uint8_t byte = *p++;
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) return p;
+	}
+}
+
+// Encode a ^ b as (unchanged run length, changed run length, changed bytes)
+//	 tokens. Returns the encoded size.
+static uint32_t rle_xor_encode(const uint8_t *a, const uint8_t *b, const uint32_t size, uint8_t *out) {
+	uint8_t *p = out;
+	uint32_t i = 0;
+
+	while (i < size) {
+		const uint32_t run_start = i;
+		while (i + 8 <= size && memcmp(&a[i], &b[i], 8) == 0) i += 8;	// Most bytes are unchanged
+		while (i < size && a[i] == b[i]) i++;
+
+		const uint32_t changed_start = i;
+		while (i < size && a[i] != b[i]) i++;
+
+		p = put_varint(p, changed_start - run_start);
+		p = put_varint(p, i - changed_start);
+		for (uint32_t j = changed_start; j < i; j++) *p++ = a[j] ^ b[j];
+	}
+
+	return p - out;
+}
+
+// XOR an encoded delta into dst
+static void rle_xor_apply(uint8_t *dst, const uint8_t *in, const uint32_t size) {
+	const uint8_t *end = in + size;
+	uint32_t i = 0;
+
+	while (in < end) {
+		uint64_t unchanged, changed;
+		in = get_varint(in, &unchanged);
+		in = get_varint(in, &changed);
+		i += unchanged;
+		while (changed--) dst[i++] ^= *in++;
+	}
+}
+
+static inline rewind_entry_t *rewind_entry(rewind_t *rewind, const uint32_t age) {
+	return &rewind->entries[(rewind->oldest + age) % REWIND_MAX_FRAMES];
+}
+
+// Drop the oldest entry, and the deltas of its group that would be left without their keyframe
+static void rewind_evict(rewind_t *rewind) {
+	do {
+		rewind->oldest = (rewind->oldest + 1) % REWIND_MAX_FRAMES;
+		rewind->count--;
+	} while (rewind->count && rewind_entry(rewind, 0)->group_pos != 0);
+}
+
+// Record the machine state at the end of a frame
+void rewind_push(rewind_t *rewind, const chip8_t *chip8) {
+	static const chip8_snapshot_t zero;
+	const rewind_entry_t *newest = rewind->count ? rewind_entry(rewind, rewind->count - 1) : NULL;
+	const uint16_t group_pos = (newest && newest->group_pos + 1 < REWIND_KEYFRAME_INTERVAL) ? newest->group_pos + 1 : 0;
+
+	chip8_snapshot(chip8, &rewind->frame);
+	if (group_pos == 0) rewind->keyframe = rewind->frame;
+
+	// Keyframes are encoded against zeros, deltas against their keyframe
+	const chip8_snapshot_t *base = group_pos ? &rewind->keyframe : &zero;
+	const uint32_t size = rle_xor_encode((const uint8_t *)rewind->frame.data, (const uint8_t *)base->data,
+										 CHIP8_SNAPSHOT_SIZE, rewind->encoded);
+
+	// Place after the newest entry, wrapping to the arena start if it does
+	//	 not fit; oldest entries in the way are evicted
+	uint32_t pos = rewind->write_pos;
+	if (pos + size > rewind->arena_size) {
+		while (rewind->count && rewind_entry(rewind, 0)->offset >= pos) rewind_evict(rewind);
+		pos = 0;
+	}
+	while (rewind->count && rewind_entry(rewind, 0)->offset >= pos && rewind_entry(rewind, 0)->offset < pos + size) {
+		rewind_evict(rewind);
+	}
+	if (rewind->count == REWIND_MAX_FRAMES) rewind_evict(rewind);
+
+	// A delta whose keyframe was just evicted cannot be decoded; start a new group
+	if (group_pos && !rewind->count) {
+		rewind->write_pos = pos;
+		rewind_push(rewind, chip8);
+		return;
+	}
+
+	memcpy(&rewind->arena[pos], rewind->encoded, size);
+	*rewind_entry(rewind, rewind->count++) = (rewind_entry_t){
+		.offset = pos,
+		.size = size,
+		.group_pos = group_pos,
+	};
+	rewind->write_pos = pos + size;
+}
+
+// Step back one frame: drop the newest entry and restore the machine to the
+//	 one before it, which becomes the newest. Returns false if there is no
+//	 earlier frame to go back to.
+bool rewind_pop(rewind_t *rewind, chip8_t *chip8) {
+	if (rewind->count < 2) return false;
+
+	const rewind_entry_t dropped = *rewind_entry(rewind, --rewind->count);
+	rewind->write_pos = dropped.offset;
+
+	const rewind_entry_t *newest = rewind_entry(rewind, rewind->count - 1);
+
+	// Stepped back into the previous group: decode its keyframe
+	if (dropped.group_pos == 0) {
+		const rewind_entry_t *key = rewind_entry(rewind, rewind->count - 1 - newest->group_pos);
+		memset(rewind->keyframe.data, 0, sizeof rewind->keyframe.data);
+		rle_xor_apply((uint8_t *)rewind->keyframe.data, &rewind->arena[key->offset], key->size);
+	}
+
+	rewind->frame = rewind->keyframe;
+	if (newest->group_pos) rle_xor_apply((uint8_t *)rewind->frame.data, &rewind->arena[newest->offset], newest->size);
+
+	chip8_restore(chip8, &rewind->frame);
+	return true;
+}
+
+#ifdef DEBUG
+void print_debug_info(chip8_t *chip8) {
+	printf("Address: 0x%04X, Opcode: 0x%04X Desc: ", chip8->PC-2, chip8->inst.opcode);
+	switch ((chip8->inst.opcode >> 12) & 0x0F) {
+	case 0x0:
+		if (chip8->inst.NN == 0xE0) {
+			// 0x00E0: Clear the screen
+			printf("Clear screen\n");
+			// memset(&chip8->display[0], false, sizeof chip8->display);
+
+		} else if (chip8->inst.NN == 0xEE) {
+			// 0x00EE: Return from subroutine
+			// Set PC to last address on subroutine stack ("pop" it off the stack)
+			//	 so that next opcode will be gotten from that address.
+			printf("Return from subroutine to address 0x%04X\n", chip8->stack[(chip8->stack_ptr - 1) & 0x0F]);
+			// chip8->PC = chip8->stack[--chip8->stack_ptr & 0x0F];
+		} else {
+			printf("Unimplemented opcode.\n");
+		}
+		break;
+	case 0x01:
+		// 0x1NNN: Jumps to address NNN.
+		printf("Jump to NNN: (0x%04X).\n", chip8->inst.NNN);
+		break;
+	case 0x02:
+		// 0x2NNN: Call subroutine at NNN
+		printf("Call subroutine at NNN (0x%04X)\n",
+				chip8->inst.NNN); 
+		// chip8->stack[chip8->stack_ptr++ & 0x0F] = chip8->PC;
+		// chip8->PC = chip8->inst.NNN;
+		break;
+
+	case 0x06:
+		// 0x6XNN: Set register VX to NN
+		printf("Set register V%X to NN (%02X)\n", chip8->inst.X, chip8->inst.NN);
+		break;
+
+	case 0x07:
+		// 0x7XNN: Set register VX += NN
+		printf("Set register V%X (0x%02X) += NN (0x%02X). Result: 0x%02X\n",
+				chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.NN,
+				chip8->V[chip8->inst.X] + chip8->inst.NN);
+		break;
+
+	case 0x0A:
+		// 0xANNN: Set index register I to NNN
+		printf("Set I to NNN (0x%04X)\n", chip8->inst.NNN);
+		break;
+
+	case 0x0D:
+		// 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
+		//		Screen pixels are XOR'd with sprite bits,   
+		//		VF (Carry flag) is set if any screen pixels are set off;
+		// 		for collision detection or other reasons.
+
+		printf("Draw N (%u) height sprite at coords V%X (0x%02X), V%X (0x%02X) "
+			   "from memory location I (0x%04X). Set VF = 1 if any pixels are turned off.\n",
+			   chip8->inst.N, chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.Y,
+			   chip8->V[chip8->inst.Y], chip8->I);
+		break;
+
+	case 0x03:
+		// 0x3XNN: Skip next instruction if VX == NN
+		printf("Skip next instruction if V%X (0x%02X) == NN (0x%02X)\n",
+				chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.NN);
+		break;
+
+	case 0x04:
+		// 0x4XNN: Skip next instruction if VX != NN
+		printf("Skip next instruction if V%X (0x%02X) != NN (0x%02X)\n",
+				chip8->inst.X, chip8->V[chip8->inst.X], chip8->inst.NN);
+		break;
+
+	case 0x05:
+		// 0x5XY0: Skip next instruction if VX == VY
+		printf("Skip next instruction if V%X (0x%02X) == V%X (0x%02X)\n",
+				chip8->inst.X, chip8->V[chip8->inst.X],
+				chip8->inst.Y, chip8->V[chip8->inst.Y]);
+		break;
+
+	case 0x08: {
+		// 0x8XYN: ALU operation N on VX and VY
+		static const char *alu_desc[16] = {
+			[0x0] = "=", [0x1] = "|=", [0x2] = "&=", [0x3] = "^=",
+			[0x4] = "+=", [0x5] = "-=", [0x6] = "= (VY >> 1) with", [0x7] = "= (VY - VX) with",
+			[0xE] = "= (VY << 1) with",
+		};
+		if (alu_desc[chip8->inst.N]) {
+			printf("Set register V%X (0x%02X) %s V%X (0x%02X)\n",
+					chip8->inst.X, chip8->V[chip8->inst.X], alu_desc[chip8->inst.N],
+					chip8->inst.Y, chip8->V[chip8->inst.Y]);
+		} else {
+			printf("Unimplemented opcode.\n");
+		}
+		break;
+	}
+
+	case 0x09:
+		// 0x9XY0: Skip next instruction if VX != VY
+		printf("Skip next instruction if V%X (0x%02X) != V%X (0x%02X)\n",
+				chip8->inst.X, chip8->V[chip8->inst.X],
+				chip8->inst.Y, chip8->V[chip8->inst.Y]);
+		break;
+
+	case 0x0B:
+		// 0xBNNN: Jump to V0 + NNN
+		printf("Jump to V0 (0x%02X) + NNN (0x%04X)\n", chip8->V[0], chip8->inst.NNN);
+		break;
+
+	case 0x0C:
+		// 0xCXNN: Set VX to a random number & NN
+		printf("Set V%X to random byte & NN (0x%02X)\n", chip8->inst.X, chip8->inst.NN);
+		break;
+
+	case 0x0E:
+		// 0xEX9E/0xEXA1: Skip next instruction if key VX is (not) pressed
+		printf("Skip next instruction if key V%X (0x%02X) is %spressed\n",
+				chip8->inst.X, chip8->V[chip8->inst.X],
+				chip8->inst.NN == 0xA1 ? "not " : "");
+		break;
+
+	case 0x0F:
+		switch (chip8->inst.NN) {
+		case 0x07: printf("Set V%X = delay timer\n", chip8->inst.X); break;
+		case 0x0A: printf("Wait for key press and release into V%X\n", chip8->inst.X); break;
+		case 0x15: printf("Set delay timer = V%X (0x%02X)\n", chip8->inst.X, chip8->V[chip8->inst.X]); break;
+		case 0x18: printf("Set sound timer = V%X (0x%02X)\n", chip8->inst.X, chip8->V[chip8->inst.X]); break;
+		case 0x1E: printf("Set I (0x%04X) += V%X (0x%02X)\n", chip8->I, chip8->inst.X, chip8->V[chip8->inst.X]); break;
+		case 0x29: printf("Set I to font sprite for V%X (0x%02X)\n", chip8->inst.X, chip8->V[chip8->inst.X]); break;
+		case 0x33: printf("Store BCD of V%X (%u) at I (0x%04X)\n", chip8->inst.X, chip8->V[chip8->inst.X], chip8->I); break;
+		case 0x55: printf("Store V0-V%X at I (0x%04X)\n", chip8->inst.X, chip8->I); break;
+		case 0x65: printf("Load V0-V%X from I (0x%04X)\n", chip8->inst.X, chip8->I); break;
+		default: printf("Unimplemented opcode.\n"); break;
+		}
+		break;
+
+	default:
+		printf("Unimplemented opcode.\n");
+		break; // Unimplemented/invalid
+	}
+}
+#endif
+
+
+// Timers count down at 60hz of emulated time, which is measured in
+//	 instructions: tick k happens after instruction k * insts_per_second / 60,
+//	 exactly where the 60hz frame loop ends a frame. Rather than being
+//	 decremented, timers are evaluated from the instruction that set them
+//	 whenever they are read, so no runner has to stop every frame to tick them.
+static inline uint32_t timer_rate(const chip8_config_t *config) {
+	return config->insts_per_second ? config->insts_per_second : DEFAULT_INSTS_PER_SECOND;
+}
+
+// Timer ticks that happened before instruction number cycle (1-based) ran
+static inline uint64_t timer_ticks(const uint64_t cycle, const chip8_config_t *config) {
+	return cycle ? (cycle * 60 - 1) / timer_rate(config) : 0;
+}
+
+// Value at instruction cycle of a timer set to value by instruction set_cycle
+static inline uint8_t timer_value(const uint8_t value, const uint64_t set_cycle,
+								  const uint64_t cycle, const chip8_config_t *config) {
+	const uint64_t elapsed = timer_ticks(cycle, config) - timer_ticks(set_cycle, config);
+	return elapsed < value ? value - elapsed : 0;
+}
+
+// First instruction that sees a timer set to value by instruction set_cycle at 0
+static inline uint64_t timer_expiry(const uint8_t value, const uint64_t set_cycle, const chip8_config_t *config) {
+	const uint64_t tick = timer_ticks(set_cycle, config) + value;
+	return (tick * timer_rate(config) + 60) / 60;	// Smallest cycle with timer_ticks(cycle) >= tick
+}
+
+// Sound plays from the instruction that set the sound timer until the one at
+//	 which it expires
+static inline uint64_t sound_stop_cycle(const chip8_t *chip8, const chip8_config_t *config) {
+	return timer_expiry(chip8->sound_timer, chip8->sound_cycle, config);
+}
+
+// Sound is playing as of the next instruction to run
+bool sound_playing(const chip8_t *chip8, const chip8_config_t *config) {
+	return chip8->cycles + 1 < sound_stop_cycle(chip8, config);
+}
+
+// Start and stop of the sound set by the last FX18, as instruction counts:
+//	 sound plays while start <= chip8->cycles < stop. Both are known as soon
+//	 as FX18 runs, so a frontend can schedule them as events at their own
+//	 positions within a frame's audio instead of polling once per frame.
+void sound_span(const chip8_t *chip8, const chip8_config_t *config, uint64_t *start, uint64_t *stop) {
+	*start = chip8->sound_cycle;
+	*stop = sound_stop_cycle(chip8, config) - 1;
+}
+
+// Random byte for CXNN. The generator state is part of the machine, so
+//	 snapshots, replays and batch runs reproduce random numbers exactly.
+static inline uint8_t chip8_rand(chip8_t *chip8) {
+	uint32_t x = chip8->rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	chip8->rng = x;
+	return x >> 24;
+}
+
+// Instruction handlers, shared by the switch and threaded dispatch cores so
+//	 both produce identical machine state. Handlers for quirky instructions
+//	 take the profile's quirks as a constant, so each profile's copy is
+//	 specialized at compile time.
+static inline void exec_cls(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)inst; (void)config;
+	// 0x00E0: Clear the screen
+	memset(&chip8->display[0], false, sizeof chip8->display);
+	chip8->dirty_rows = 0xFFFFFFFF;
+	chip8->drawn_rows = 0xFFFFFFFF;
+}
+
+static inline void exec_ret(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)inst; (void)config;
+	// 0x00EE: Return from subroutine
+	// Set PC to last address on subroutine stack ("pop" it off the stack)
+	//	 so that next opcode will be gotten from that address.
+	chip8->PC = chip8->stack[--chip8->stack_ptr & 0x0F];
+}
+
+static inline void exec_jp(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0x1NNN: Jump to address NNN
+	chip8->PC = inst->NNN;	// Set PC so that next opcode is from NNN
+}
+
+static inline void exec_call(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0x2NNN: Call subroutine at NNN 
+	chip8->stack[chip8->stack_ptr++ & 0x0F] = chip8->PC;
+	chip8->PC = inst->NNN;
+}
+
+static inline void exec_ld_vx_nn(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0x6XNN: Set register VX to NN
+	chip8->V[inst->X] = inst->NN;
+}
+
+static inline void exec_add_vx_nn(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0x7XNN: Set register VX += NN
+	chip8->V[inst->X] += inst->NN;
+}
+
+static inline void exec_se_vx_nn(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0x3XNN: Skip next instruction if VX == NN
+	chip8->PC += 2 * (chip8->V[inst->X] == inst->NN);
+}
+
+static inline void exec_sne_vx_nn(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0x4XNN: Skip next instruction if VX != NN
+	chip8->PC += 2 * (chip8->V[inst->X] != inst->NN);
+}
+
+static inline void exec_se_vx_vy(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0x5XY0: Skip next instruction if VX == VY
+	chip8->PC += 2 * (chip8->V[inst->X] == chip8->V[inst->Y]);
+}
+
+static inline void exec_sne_vx_vy(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0x9XY0: Skip next instruction if VX != VY
+	chip8->PC += 2 * (chip8->V[inst->X] != chip8->V[inst->Y]);
+}
+
+// 0x8XY_ ALU group. Flags are computed from the operands before VX is
+//	 written and stored to VF last, so VF holds the flag even when X is F.
+static inline void exec_ld_vx_vy(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0x8XY0: Set VX = VY
+	chip8->V[inst->X] = chip8->V[inst->Y];
+}
+
+static inline void exec_or(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config, const uint8_t quirks) {
+	(void)config;
+	// 0x8XY1: Set VX |= VY, VF reset on original CHIP8
+	chip8->V[inst->X] |= chip8->V[inst->Y];
+	if (quirks & QUIRK_VF_RESET) chip8->V[0xF] = 0;
+}
+
+static inline void exec_and(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config, const uint8_t quirks) {
+	(void)config;
+	// 0x8XY2: Set VX &= VY, VF reset on original CHIP8
+	chip8->V[inst->X] &= chip8->V[inst->Y];
+	if (quirks & QUIRK_VF_RESET) chip8->V[0xF] = 0;
+}
+
+static inline void exec_xor(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config, const uint8_t quirks) {
+	(void)config;
+	// 0x8XY3: Set VX ^= VY, VF reset on original CHIP8
+	chip8->V[inst->X] ^= chip8->V[inst->Y];
+	if (quirks & QUIRK_VF_RESET) chip8->V[0xF] = 0;
+}
+
+static inline void exec_add_vx_vy(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0x8XY4: Set VX += VY, VF = carry
+	const uint16_t sum = chip8->V[inst->X] + chip8->V[inst->Y];
+	chip8->V[inst->X] = (uint8_t)sum;
+	chip8->V[0xF] = sum >> 8;
+}
+
+static inline void exec_sub(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0x8XY5: Set VX -= VY, VF = 1 if no borrow
+	const uint8_t no_borrow = chip8->V[inst->X] >= chip8->V[inst->Y];
+	chip8->V[inst->X] -= chip8->V[inst->Y];
+	chip8->V[0xF] = no_borrow;
+}
+
+static inline void exec_shr(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config, const uint8_t quirks) {
+	(void)config;
+	// 0x8XY6: Set VX = VY >> 1 (or VX >> 1), VF = bit shifted out
+	const uint8_t src = chip8->V[(quirks & QUIRK_SHIFT_VY) ? inst->Y : inst->X];
+	chip8->V[inst->X] = src >> 1;
+	chip8->V[0xF] = src & 1;
+}
+
+static inline void exec_subn(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0x8XY7: Set VX = VY - VX, VF = 1 if no borrow
+	const uint8_t no_borrow = chip8->V[inst->Y] >= chip8->V[inst->X];
+	chip8->V[inst->X] = chip8->V[inst->Y] - chip8->V[inst->X];
+	chip8->V[0xF] = no_borrow;
+}
+
+static inline void exec_shl(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config, const uint8_t quirks) {
+	(void)config;
+	// 0x8XYE: Set VX = VY << 1 (or VX << 1), VF = bit shifted out
+	const uint8_t src = chip8->V[(quirks & QUIRK_SHIFT_VY) ? inst->Y : inst->X];
+	chip8->V[inst->X] = src << 1;
+	chip8->V[0xF] = src >> 7;
+}
+
+static inline void exec_ld_i_nnn(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0xANNN: Set index register I to NNN
+	chip8->I = inst->NNN;
+}
+
+static inline void exec_jp_v0(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config, const uint8_t quirks) {
+	(void)config;
+	// 0xBNNN: Jump to address NNN + V0 (or XNN + VX on SUPER-CHIP)
+	chip8->PC = inst->NNN + chip8->V[(quirks & QUIRK_JUMP_VX) ? inst->X : 0];
+}
+
+static inline void exec_rnd(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0xCXNN: Set VX = random byte & NN
+	chip8->V[inst->X] = chip8_rand(chip8) & inst->NN;
+}
+
+static inline void exec_drw(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config, const uint8_t quirks) {
+	(void)config;
+	// 0xDXYN: Draw N-height sprite at coords X,Y; Read from memory location I;
+	//		Screen pixels are XOR'd with sprite bits,   
+	//		VF (Carry flag) is set if any screen pixels are set off;
+	// 		for collision detection or other reasons.
+	const uint8_t X_coord = chip8->V[inst->X] % CHIP8_DISPLAY_WIDTH;
+	const uint8_t Y_coord = chip8->V[inst->Y] % CHIP8_DISPLAY_HEIGHT;
+	uint8_t collision = 0;
+	uint32_t dirty = 0;
+
+	// Rows beyond the bottom edge of the screen are clipped, or wrap to the top
+	const uint8_t rows = (!(quirks & QUIRK_WRAP) && Y_coord + inst->N > CHIP8_DISPLAY_HEIGHT) ?
+						 CHIP8_DISPLAY_HEIGHT - Y_coord : inst->N;
+
+	// Each sprite row is one shift + XOR on a display row; bits shifted past
+	//	 the right edge of the screen fall off, which clips the sprite, or are
+	//	 rotated back in at the left edge to wrap it.
+	for (uint8_t i = 0; i < rows; ++i) {
+		const uint64_t sprite_byte = (uint64_t)chip8_ram(chip8, (chip8->I + i) & 0x0FFF) << 56;
+		const uint64_t sprite_row = (quirks & QUIRK_WRAP) ?
+									(sprite_byte >> X_coord) | (sprite_byte << ((64 - X_coord) & 63)) :
+									sprite_byte >> X_coord;
+		const uint8_t y = (quirks & QUIRK_WRAP) ? (Y_coord + i) % CHIP8_DISPLAY_HEIGHT : Y_coord + i;
+		uint64_t *display_row = &chip8->display[y];
+
+		collision |= (*display_row & sprite_row) != 0;
+		dirty |= (uint32_t)(sprite_row != 0) << y;
+		*display_row ^= sprite_row;
+	}
+
+	chip8->V[0xF] = collision;	// Carry flag VF set if any pixel was turned off
+	chip8->dirty_rows |= dirty;
+	chip8->drawn_rows |= dirty;
+}
+
+static inline void exec_skp(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0xEX9E: Skip next instruction if key VX is pressed
+	chip8->PC += 2 * ((chip8->keypad >> (chip8->V[inst->X] & 0x0F)) & 1);
+}
+
+static inline void exec_sknp(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0xEXA1: Skip next instruction if key VX is not pressed
+	chip8->PC += 2 * (~(chip8->keypad >> (chip8->V[inst->X] & 0x0F)) & 1);
+}
+
+static inline void exec_ld_vx_dt(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	// 0xFX07: Set VX = delay timer
+	chip8->V[inst->X] = timer_value(chip8->delay_timer, chip8->delay_cycle, chip8->cycles, config);
+}
+
+static inline void exec_ld_vx_k(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0xFX0A: Wait for a key press and release, then store the key in VX
+	if (!chip8->key_wait && chip8->keypad) {
+		uint8_t key = 0;
+		while (!(chip8->keypad & (1u << key))) key++;
+		chip8->key_wait = key + 1;
+	}
+
+	if (chip8->key_wait && !(chip8->keypad & (1u << (chip8->key_wait - 1)))) {
+		chip8->V[inst->X] = chip8->key_wait - 1;
+		chip8->key_wait = 0;
+	} else {
+		chip8->PC -= 2;	// Keep waiting: run this instruction again
+	}
+}
+
+static inline void exec_ld_dt_vx(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0xFX15: Set delay timer = VX
+	chip8->delay_timer = chip8->V[inst->X];
+	chip8->delay_cycle = chip8->cycles;
+}
+
+static inline void exec_ld_st_vx(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0xFX18: Set sound timer = VX
+	chip8->sound_timer = chip8->V[inst->X];
+	chip8->sound_cycle = chip8->cycles;
+}
+
+static inline void exec_add_i_vx(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0xFX1E: Set I += VX
+	chip8->I += chip8->V[inst->X];
+}
+
+static inline void exec_ld_f_vx(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0xFX29: Set I to font sprite for digit VX, 5 bytes per digit from address 0
+	chip8->I = (chip8->V[inst->X] & 0x0F) * 5;
+}
+
+static inline void exec_ld_b_vx(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config) {
+	(void)config;
+	// 0xFX33: Store BCD of VX at I, I+1, I+2
+	const uint8_t value = chip8->V[inst->X];
+	write_ram(chip8, chip8->I, value / 100);
+	write_ram(chip8, chip8->I + 1, value / 10 % 10);
+	write_ram(chip8, chip8->I + 2, value % 10);
+}
+
+static inline void exec_ld_i_vx(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config, const uint8_t quirks) {
+	(void)config;
+	// 0xFX55: Store V0-VX at I onwards, I is left pointing past them on original CHIP8.
+	//	 X is read once: the stores may overwrite this instruction's own decoded entry.
+	const uint8_t X = inst->X;
+	for (uint8_t i = 0; i <= X; i++) write_ram(chip8, chip8->I + i, chip8->V[i]);
+	if (quirks & QUIRK_MEM_INC_I) chip8->I += X + 1;
+}
+
+static inline void exec_ld_vx_i(chip8_t *chip8, const instruction_t *inst, const chip8_config_t *config, const uint8_t quirks) {
+	(void)config;
+	// 0xFX65: Load V0-VX from I onwards, I is left pointing past them on original CHIP8
+	for (uint8_t i = 0; i <= inst->X; i++) chip8->V[i] = chip8_ram(chip8, (chip8->I + i) & 0x0FFF);
+	if (quirks & QUIRK_MEM_INC_I) chip8->I += inst->X + 1;
+}
+
+#ifdef DEBUG
+#define DEBUG_HOOK() do { chip8->inst = *inst; print_debug_info(chip8); } while (0)
+#else
+#define DEBUG_HOOK() do { } while (0)
+#endif
+
+// Emulate 1 CHIP8 instruction, specialized for one quirk profile:
+//	 defines emulate_instruction_<name>() for each of CHIP8_PROFILES
+#define EMULATE_INSTRUCTION(name, profile, quirks)										\
+static void emulate_instruction_##name(chip8_t *chip8, const chip8_config_t config) {				\
+	/* Get next predecoded instruction, opcode and operands are already split out */	\
+	const instruction_t *inst = chip8_decoded(chip8, chip8->PC & 0x0FFF);						\
+	chip8->PC += 2; 	/* Increment PC for next opcode */								\
+	chip8->cycles++;																	\
+	DEBUG_HOOK();																		\
+																						\
+	/* Emulate opcode */																\
+	switch (inst->op) {																	\
+	case OP_CLS:		exec_cls(chip8, inst, &config); break;							\
+	case OP_RET:		exec_ret(chip8, inst, &config); break;							\
+	case OP_JP:																			\
+	case OP_JP_SELF:																	\
+	case OP_JP_WAIT:	exec_jp(chip8, inst, &config); break;							\
+	case OP_CALL:		exec_call(chip8, inst, &config); break;							\
+	case OP_SE_VX_NN:	exec_se_vx_nn(chip8, inst, &config); break;						\
+	case OP_SNE_VX_NN:	exec_sne_vx_nn(chip8, inst, &config); break;					\
+	case OP_SE_VX_VY:	exec_se_vx_vy(chip8, inst, &config); break;						\
+	case OP_LD_VX_NN:	exec_ld_vx_nn(chip8, inst, &config); break;						\
+	case OP_ADD_VX_NN:	exec_add_vx_nn(chip8, inst, &config); break;					\
+	case OP_LD_VX_VY:	exec_ld_vx_vy(chip8, inst, &config); break;						\
+	case OP_OR:			exec_or(chip8, inst, &config, quirks); break;					\
+	case OP_AND:		exec_and(chip8, inst, &config, quirks); break;					\
+	case OP_XOR:		exec_xor(chip8, inst, &config, quirks); break;					\
+	case OP_ADD_VX_VY:	exec_add_vx_vy(chip8, inst, &config); break;					\
+	case OP_SUB:		exec_sub(chip8, inst, &config); break;							\
+	case OP_SHR:		exec_shr(chip8, inst, &config, quirks); break;					\
+	case OP_SUBN:		exec_subn(chip8, inst, &config); break;							\
+	case OP_SHL:		exec_shl(chip8, inst, &config, quirks); break;					\
+	case OP_SNE_VX_VY:	exec_sne_vx_vy(chip8, inst, &config); break;					\
+	case OP_LD_I_NNN:	exec_ld_i_nnn(chip8, inst, &config); break;						\
+	case OP_JP_V0:		exec_jp_v0(chip8, inst, &config, quirks); break;				\
+	case OP_RND:		exec_rnd(chip8, inst, &config); break;							\
+	case OP_DRW:		exec_drw(chip8, inst, &config, quirks); break;					\
+	case OP_SKP:		exec_skp(chip8, inst, &config); break;							\
+	case OP_SKNP:		exec_sknp(chip8, inst, &config); break;							\
+	case OP_LD_VX_DT:	exec_ld_vx_dt(chip8, inst, &config); break;						\
+	case OP_LD_VX_K:	exec_ld_vx_k(chip8, inst, &config); break;						\
+	case OP_LD_DT_VX:	exec_ld_dt_vx(chip8, inst, &config); break;						\
+	case OP_LD_ST_VX:	exec_ld_st_vx(chip8, inst, &config); break;						\
+	case OP_ADD_I_VX:	exec_add_i_vx(chip8, inst, &config); break;						\
+	case OP_LD_F_VX:	exec_ld_f_vx(chip8, inst, &config); break;						\
+	case OP_LD_B_VX:	exec_ld_b_vx(chip8, inst, &config); break;						\
+	case OP_LD_I_VX:	exec_ld_i_vx(chip8, inst, &config, quirks); break;				\
+	case OP_LD_VX_I:	exec_ld_vx_i(chip8, inst, &config, quirks); break;				\
+																						\
+	default:																			\
+		break; /* Unimplemented/invalid */												\
+	}																					\
+}
+
+CHIP8_PROFILES(EMULATE_INSTRUCTION)
+#undef EMULATE_INSTRUCTION
+
+// Emulate 1 CHIP8 instruction with the quirks of config.profile
+void emulate_instruction(chip8_t *chip8, const chip8_config_t config) {
+	switch (config.profile) {
+#define PROFILE_CASE(name, profile, quirks) case profile: emulate_instruction_##name(chip8, config); break;
+	CHIP8_PROFILES(PROFILE_CASE)
+#undef PROFILE_CASE
+	default: break;
+	}
+}
+
+// Idle loop detection. Returns the length in instructions of the idle loop
+//	 PC is at the head of, 0 if none. An idle loop cannot exit before the next
+//	 input change, which never happens within a batch of instructions, so
+//	 runners skip whole iterations of it at once and the frontend can sleep
+//	 instead of spinning on it:
+//	 - 1NNN jumping to itself, which nothing but a reset leaves
+//	 - FX0A with no key to register
+static inline uint8_t idle_loop_length(const chip8_t *chip8) {
+	if (chip8->PC > 0x0FFF) return 0;
+
+	const instruction_t *inst = chip8_decoded(chip8, chip8->PC);
+	switch (inst->op) {
+	case OP_JP_SELF:
+		return 1;
+
+	case OP_LD_VX_K:
+		if (chip8->key_wait) return (chip8->keypad >> (chip8->key_wait - 1)) & 1;
+		return chip8->keypad == 0;
+
+	default:
+		return 0;
+	}
+}
+
+bool chip8_is_idle(const chip8_t *chip8) {
+	return idle_loop_length(chip8) != 0;
+}
+
+// PC is at the head of a delay timer wait loop: FX07, 3X00, 1NNN back to the FX07
+static inline bool timer_wait_loop(const chip8_t *chip8) {
+	if (chip8->PC > 0x0FFA) return false;
+
+	const instruction_t *inst = chip8_decoded(chip8, chip8->PC);
+	const instruction_t *skip = chip8_decoded(chip8, chip8->PC + 2);
+	const instruction_t *jump = chip8_decoded(chip8, chip8->PC + 4);
+	return inst->op == OP_LD_VX_DT &&
+		   skip->op == OP_SE_VX_NN && skip->X == inst->X && skip->NN == 0 &&
+		   jump->op == OP_JP_WAIT && jump->NNN == chip8->PC;
+}
+
+// Skip as many of count instructions as make whole iterations of the idle
+//	 loop at PC, if any, leaving state as if they had run. Returns the number
+//	 of instructions skipped.
+// Timer wait loops are skipped up to the last iteration that still reads a
+//	 running timer, since when the timer expires is known in advance.
+static inline uint64_t idle_skip(chip8_t *chip8, const chip8_config_t *config, const uint64_t count) {
+	uint64_t skip = 0;
+
+	const uint8_t length = idle_loop_length(chip8);
+	if (length) {
+		skip = count - count % length;
+	} else if (timer_wait_loop(chip8)) {
+		// Iterations whose FX07 (at cycle + 1 + 3i) runs before the timer expires
+		const uint64_t expiry = timer_expiry(chip8->delay_timer, chip8->delay_cycle, config);
+		const uint64_t next = chip8->cycles + 1;
+		const uint64_t iterations = expiry > next ? (expiry - next + 2) / 3 : 0;
+
+		skip = (iterations < count / 3 ? iterations : count / 3) * 3;
+		if (skip) {
+			// Each iteration leaves VX = delay timer as its FX07 read it
+			const instruction_t *inst = chip8_decoded(chip8, chip8->PC);
+			chip8->V[inst->X] = timer_value(chip8->delay_timer, chip8->delay_cycle,
+											chip8->cycles + skip - 2, config);
+		}
+	}
+
+	chip8->cycles += skip;
+	return skip;
+}
+
+// Emulate count CHIP8 instructions.
+// GCC/Clang builds use direct-threaded dispatch: every handler ends in its own
+//	 indirect jump through the handler table, so the branch predictor sees one
+//	 jump site per opcode instead of a single shared switch jump.
+// Each quirk profile gets its own handler table, whose quirky instructions
+//	 jump to handlers specialized for it; the table is picked once per call.
+// Define CHIP8_SWITCH_DISPATCH at build time to use the switch core instead.
+void run_instructions(chip8_t *chip8, const chip8_config_t config, uint64_t count) {
+#if defined(__GNUC__) && !defined(CHIP8_SWITCH_DISPATCH)
+#define THREADED_HANDLERS(name, profile, quirks)	\
+	[profile] = {									\
+		[OP_INVALID]	= &&op_invalid,				\
+		[OP_CLS]		= &&op_cls,					\
+		[OP_RET]		= &&op_ret,					\
+		[OP_JP]			= &&op_jp,					\
+		[OP_JP_SELF]	= &&op_jp_idle,				\
+		[OP_JP_WAIT]	= &&op_jp_idle,				\
+		[OP_CALL]		= &&op_call,				\
+		[OP_SE_VX_NN]	= &&op_se_vx_nn,			\
+		[OP_SNE_VX_NN]	= &&op_sne_vx_nn,			\
+		[OP_SE_VX_VY]	= &&op_se_vx_vy,			\
+		[OP_LD_VX_NN]	= &&op_ld_vx_nn,			\
+		[OP_ADD_VX_NN]	= &&op_add_vx_nn,			\
+		[OP_LD_VX_VY]	= &&op_ld_vx_vy,			\
+		[OP_OR]			= &&op_or_##name,			\
+		[OP_AND]		= &&op_and_##name,			\
+		[OP_XOR]		= &&op_xor_##name,			\
+		[OP_ADD_VX_VY]	= &&op_add_vx_vy,			\
+		[OP_SUB]		= &&op_sub,					\
+		[OP_SHR]		= &&op_shr_##name,			\
+		[OP_SUBN]		= &&op_subn,				\
+		[OP_SHL]		= &&op_shl_##name,			\
+		[OP_SNE_VX_VY]	= &&op_sne_vx_vy,			\
+		[OP_LD_I_NNN]	= &&op_ld_i_nnn,			\
+		[OP_JP_V0]		= &&op_jp_v0_##name,		\
+		[OP_RND]		= &&op_rnd,					\
+		[OP_DRW]		= &&op_drw_##name,			\
+		[OP_SKP]		= &&op_skp,					\
+		[OP_SKNP]		= &&op_sknp,				\
+		[OP_LD_VX_DT]	= &&op_ld_vx_dt,			\
+		[OP_LD_VX_K]	= &&op_ld_vx_k,				\
+		[OP_LD_DT_VX]	= &&op_ld_dt_vx,			\
+		[OP_LD_ST_VX]	= &&op_ld_st_vx,			\
+		[OP_ADD_I_VX]	= &&op_add_i_vx,			\
+		[OP_LD_F_VX]	= &&op_ld_f_vx,				\
+		[OP_LD_B_VX]	= &&op_ld_b_vx,				\
+		[OP_LD_I_VX]	= &&op_ld_i_vx_##name,		\
+		[OP_LD_VX_I]	= &&op_ld_vx_i_##name,		\
+	},
+
+	static const void *const profile_handlers[PROFILE_COUNT][OP_COUNT] = {
+		CHIP8_PROFILES(THREADED_HANDLERS)
+	};
+#undef THREADED_HANDLERS
+	const void *const *handlers = profile_handlers[config.profile];
+	const instruction_t *inst;
+
+	// Predecoded instructions of the page PC is in, kept across dispatches
+	//	 so fetching is one load. Reloaded when PC leaves the page, or RAM is
+	//	 written, which may have moved the page to a private copy.
+	const instruction_t *code = NULL;
+	uint8_t code_page = CHIP8_PAGES;
+
+	// Fetch next predecoded instruction and jump straight to its handler
+#define DISPATCH() do {										\
+		if (count-- == 0) return;							\
+		const uint8_t page = (chip8->PC >> CHIP8_PAGE_BITS) & 0x0F;	\
+		if (page != code_page) {							\
+			code_page = page;								\
+			code = chip8->page[page]->decoded;				\
+		}													\
+		inst = &code[chip8->PC & CHIP8_PAGE_MASK];			\
+		chip8->PC += 2;										\
+		chip8->cycles++;									\
+		DEBUG_HOOK();										\
+		goto *handlers[inst->op];							\
+	} while (0)
+
+	// Only instructions that land PC on an idle loop head check for one
+#define IDLE_SKIP() do { count -= idle_skip(chip8, &config, count); } while (0)
+#define WROTE_RAM() do { code_page = CHIP8_PAGES; } while (0)
+
+	DISPATCH();
+
+op_invalid:		DISPATCH(); // Unimplemented/invalid
+op_cls:			exec_cls(chip8, inst, &config); DISPATCH();
+op_ret:			exec_ret(chip8, inst, &config); DISPATCH();
+op_jp:			exec_jp(chip8, inst, &config); DISPATCH();
+op_jp_idle:		exec_jp(chip8, inst, &config); IDLE_SKIP(); DISPATCH();
+op_call:		exec_call(chip8, inst, &config); DISPATCH();
+op_se_vx_nn:	exec_se_vx_nn(chip8, inst, &config); DISPATCH();
+op_sne_vx_nn:	exec_sne_vx_nn(chip8, inst, &config); DISPATCH();
+op_se_vx_vy:	exec_se_vx_vy(chip8, inst, &config); DISPATCH();
+op_ld_vx_nn:	exec_ld_vx_nn(chip8, inst, &config); DISPATCH();
+op_add_vx_nn:	exec_add_vx_nn(chip8, inst, &config); DISPATCH();
+op_ld_vx_vy:	exec_ld_vx_vy(chip8, inst, &config); DISPATCH();
+op_add_vx_vy:	exec_add_vx_vy(chip8, inst, &config); DISPATCH();
+op_sub:			exec_sub(chip8, inst, &config); DISPATCH();
+op_subn:		exec_subn(chip8, inst, &config); DISPATCH();
+op_sne_vx_vy:	exec_sne_vx_vy(chip8, inst, &config); DISPATCH();
+op_ld_i_nnn:	exec_ld_i_nnn(chip8, inst, &config); DISPATCH();
+op_rnd:			exec_rnd(chip8, inst, &config); DISPATCH();
+op_skp:			exec_skp(chip8, inst, &config); DISPATCH();
+op_sknp:		exec_sknp(chip8, inst, &config); DISPATCH();
+op_ld_vx_dt:	exec_ld_vx_dt(chip8, inst, &config); DISPATCH();
+op_ld_vx_k:		exec_ld_vx_k(chip8, inst, &config); IDLE_SKIP(); DISPATCH();
+op_ld_dt_vx:	exec_ld_dt_vx(chip8, inst, &config); DISPATCH();
+op_ld_st_vx:	exec_ld_st_vx(chip8, inst, &config); DISPATCH();
+op_add_i_vx:	exec_add_i_vx(chip8, inst, &config); DISPATCH();
+op_ld_f_vx:		exec_ld_f_vx(chip8, inst, &config); DISPATCH();
+op_ld_b_vx:		exec_ld_b_vx(chip8, inst, &config); WROTE_RAM(); DISPATCH();
+
+	// Quirky instructions, one specialized copy per profile
+#define THREADED_QUIRK_HANDLERS(name, profile, quirks)										\
+op_or_##name:		exec_or(chip8, inst, &config, quirks); DISPATCH();					\
+op_and_##name:		exec_and(chip8, inst, &config, quirks); DISPATCH();					\
+op_xor_##name:		exec_xor(chip8, inst, &config, quirks); DISPATCH();					\
+op_shr_##name:		exec_shr(chip8, inst, &config, quirks); DISPATCH();					\
+op_shl_##name:		exec_shl(chip8, inst, &config, quirks); DISPATCH();					\
+op_jp_v0_##name:	exec_jp_v0(chip8, inst, &config, quirks); DISPATCH();				\
+op_drw_##name:		exec_drw(chip8, inst, &config, quirks); DISPATCH();					\
+op_ld_i_vx_##name:	exec_ld_i_vx(chip8, inst, &config, quirks); WROTE_RAM(); DISPATCH();	\
+op_ld_vx_i_##name:	exec_ld_vx_i(chip8, inst, &config, quirks); DISPATCH();
+
+	CHIP8_PROFILES(THREADED_QUIRK_HANDLERS)
+
+#undef THREADED_QUIRK_HANDLERS
+#undef WROTE_RAM
+#undef IDLE_SKIP
+#undef DISPATCH
+#else
+	// Switch core: pick the profile's specialized emulate_instruction once
+#define SWITCH_CORE(name, profile, quirks)							\
+	case profile:													\
+		while (count) {												\
+			count -= idle_skip(chip8, &config, count);	/* Fast-forward idle loops */	\
+			if (!count) return;										\
+																	\
+			emulate_instruction_##name(chip8, config);				\
+			count--;												\
+		}															\
+		break;
+
+	switch (config.profile) {
+	CHIP8_PROFILES(SWITCH_CORE)
+	default: break;
+	}
+#undef SWITCH_CORE
+#endif
+}
+#undef DEBUG_HOOK
+
+// Cached block interpreter
+// On first execution of an address, the run of instructions up to and
+//	 including the next branch is built into an array of handler pointers,
+//	 with common sequences fused into superinstructions. Running a block is
+//	 then one indirect call per entry, with PC and cycles updated once.
+//	 Skips stay inside the block as conditional steps over the next entry.
+#define BLOCK_MAX_INSTS 64				// Max CHIP8 instructions per block
+#define BLOCK_ARENA_SIZE (64 * 1024)	// Block entries in arena, flushed when full
+
+typedef struct block_inst block_inst_t;
+typedef bool (*block_handler_t)(chip8_t *chip8, const block_inst_t *bi, const chip8_config_t *config);	// True skips the next entry
+
+// Block entry: handler plus the first of the predecoded instructions it covers.
+//	 Fused entries read the following instructions at inst + 2, inst + 4,
+//	 since predecoded instructions are stored per RAM address of a page.
+struct block_inst {
+	block_handler_t handler;
+	const instruction_t *inst;
+	uint16_t retired;		// Block's instructions up to and including this entry's
+};
+
+// Cached block starting at a RAM address
+typedef struct {
+	uint64_t page_id[2];	// Ids of the pages of its first and last instruction, 0 if not built
+	uint32_t first;			// Index of first entry in arena
+	uint16_t body_len;		// Entries to run before PC is updated
+	uint16_t count;			// CHIP8 instructions covered
+	uint16_t end_pc;		// PC after the last covered instruction
+	uint8_t last_page;		// Page of its last instruction
+	bool has_branch;		// Last entry ends the block (see block_is_branch) and runs after PC is updated
+} cached_block_t;
+
+// Blocks are only run on a machine whose pages still have the ids they were
+//	 built from, so one cache can serve any machine; see core_share()
+struct block_cache {
+	block_inst_t arena[BLOCK_ARENA_SIZE];
+	uint32_t arena_used;
+	cached_block_t blocks[CHIP8_RAM_SIZE];	// Block per start address
+	bool code_map[CHIP8_RAM_SIZE];			// RAM byte is covered by a block built from a machine's own page
+	bool shared;							// Only build blocks from pages machines share with their image
+};
+
+#define BLOCK_HANDLER(name)																\
+	static bool block_##name(chip8_t *chip8, const block_inst_t *bi, const chip8_config_t *config) {	\
+		exec_##name(chip8, bi->inst, config);											\
+		return false;																	\
+	}
+
+// Timer instructions run mid-block, where chip8->cycles is still the count
+//	 at block start less any skipped entries, so step it to their own cycle
+#define BLOCK_TIMER_HANDLER(name)														\
+	static bool block_##name(chip8_t *chip8, const block_inst_t *bi, const chip8_config_t *config) {	\
+		chip8->cycles += bi->retired;													\
+		exec_##name(chip8, bi->inst, config);											\
+		chip8->cycles -= bi->retired;													\
+		return false;																	\
+	}
+
+// Skips that are not the block's last entry: leave PC alone and have
+//	 block_run() step over the next entry instead
+#define BLOCK_SKIP_HANDLER(name, condition)												\
+	static bool block_skip_##name(chip8_t *chip8, const block_inst_t *bi, const chip8_config_t *config) {	\
+		(void)config;																	\
+		const instruction_t *inst = bi->inst;											\
+		return condition;																\
+	}
+
+BLOCK_HANDLER(cls)
+BLOCK_HANDLER(ret)
+BLOCK_HANDLER(jp)
+BLOCK_HANDLER(call)
+BLOCK_HANDLER(se_vx_nn)
+BLOCK_HANDLER(sne_vx_nn)
+BLOCK_HANDLER(se_vx_vy)
+BLOCK_HANDLER(ld_vx_nn)
+BLOCK_HANDLER(add_vx_nn)
+BLOCK_HANDLER(ld_vx_vy)
+BLOCK_HANDLER(add_vx_vy)
+BLOCK_HANDLER(sub)
+BLOCK_HANDLER(subn)
+BLOCK_HANDLER(sne_vx_vy)
+BLOCK_HANDLER(ld_i_nnn)
+BLOCK_HANDLER(rnd)
+BLOCK_HANDLER(skp)
+BLOCK_HANDLER(sknp)
+BLOCK_HANDLER(ld_vx_k)
+BLOCK_HANDLER(add_i_vx)
+BLOCK_HANDLER(ld_f_vx)
+BLOCK_HANDLER(ld_b_vx)
+BLOCK_TIMER_HANDLER(ld_vx_dt)
+BLOCK_TIMER_HANDLER(ld_dt_vx)
+BLOCK_TIMER_HANDLER(ld_st_vx)
+BLOCK_SKIP_HANDLER(se_vx_nn, chip8->V[inst->X] == inst->NN)
+BLOCK_SKIP_HANDLER(sne_vx_nn, chip8->V[inst->X] != inst->NN)
+BLOCK_SKIP_HANDLER(se_vx_vy, chip8->V[inst->X] == chip8->V[inst->Y])
+BLOCK_SKIP_HANDLER(sne_vx_vy, chip8->V[inst->X] != chip8->V[inst->Y])
+BLOCK_SKIP_HANDLER(skp, (chip8->keypad >> (chip8->V[inst->X] & 0x0F)) & 1)
+BLOCK_SKIP_HANDLER(sknp, ~(chip8->keypad >> (chip8->V[inst->X] & 0x0F)) & 1)
+#undef BLOCK_SKIP_HANDLER
+#undef BLOCK_TIMER_HANDLER
+#undef BLOCK_HANDLER
+
+// Quirky instructions, one specialized copy per profile
+#define BLOCK_QUIRK_HANDLER(name, profile, quirks, op)									\
+	static bool block_##op##_##name(chip8_t *chip8, const block_inst_t *bi, const chip8_config_t *config) {	\
+		exec_##op(chip8, bi->inst, config, quirks);										\
+		return false;																	\
+	}
+
+#define BLOCK_QUIRK_HANDLERS(name, profile, quirks)		\
+	BLOCK_QUIRK_HANDLER(name, profile, quirks, or)		\
+	BLOCK_QUIRK_HANDLER(name, profile, quirks, and)		\
+	BLOCK_QUIRK_HANDLER(name, profile, quirks, xor)		\
+	BLOCK_QUIRK_HANDLER(name, profile, quirks, shr)		\
+	BLOCK_QUIRK_HANDLER(name, profile, quirks, shl)		\
+	BLOCK_QUIRK_HANDLER(name, profile, quirks, jp_v0)	\
+	BLOCK_QUIRK_HANDLER(name, profile, quirks, drw)		\
+	BLOCK_QUIRK_HANDLER(name, profile, quirks, ld_i_vx)	\
+	BLOCK_QUIRK_HANDLER(name, profile, quirks, ld_vx_i)
+
+CHIP8_PROFILES(BLOCK_QUIRK_HANDLERS)
+#undef BLOCK_QUIRK_HANDLERS
+#undef BLOCK_QUIRK_HANDLER
+
+static bool block_invalid(chip8_t *chip8, const block_inst_t *bi, const chip8_config_t *config) {
+	(void)chip8; (void)bi; (void)config; // Unimplemented/invalid
+	return false;
+}
+
+// Superinstructions
+// 6XNN + 6YNN + DXYN: set sprite coordinates and draw
+// ANNN + DXYN: point I at sprite and draw
+#define BLOCK_DRW_SUPERINSTRUCTIONS(name, profile, quirks)								\
+	static bool block_ld_ld_drw_##name(chip8_t *chip8, const block_inst_t *bi, const chip8_config_t *config) {	\
+		exec_ld_vx_nn(chip8, bi->inst, config);											\
+		exec_ld_vx_nn(chip8, bi->inst + 2, config);										\
+		exec_drw(chip8, bi->inst + 4, config, quirks);									\
+		return false;																	\
+	}																					\
+																						\
+	static bool block_ld_i_drw_##name(chip8_t *chip8, const block_inst_t *bi, const chip8_config_t *config) {	\
+		exec_ld_i_nnn(chip8, bi->inst, config);											\
+		exec_drw(chip8, bi->inst + 2, config, quirks);									\
+		return false;																	\
+	}
+
+CHIP8_PROFILES(BLOCK_DRW_SUPERINSTRUCTIONS)
+#undef BLOCK_DRW_SUPERINSTRUCTIONS
+
+// 6XNN + 6YNN
+static bool block_ld_ld(chip8_t *chip8, const block_inst_t *bi, const chip8_config_t *config) {
+	exec_ld_vx_nn(chip8, bi->inst, config);
+	exec_ld_vx_nn(chip8, bi->inst + 2, config);
+	return false;
+}
+
+// 7XNN + 1NNN: loop tail
+static bool block_add_jp(chip8_t *chip8, const block_inst_t *bi, const chip8_config_t *config) {
+	exec_add_vx_nn(chip8, bi->inst, config);
+	exec_jp(chip8, bi->inst + 2, config);
+	return false;
+}
+
+// 7XNN + 3XNN + 1NNN: count VX up and loop until it reaches NN
+static bool block_add_se_jp(chip8_t *chip8, const block_inst_t *bi, const chip8_config_t *config) {
+	exec_add_vx_nn(chip8, bi->inst, config);
+
+	// Skip taken: PC is already past the jump, and the jump never ran so it
+	//	 is taken back out of the cycles the block counted for it
+	const bool done = (chip8->V[bi->inst[2].X] == bi->inst[2].NN);
+	chip8->PC = done ? chip8->PC : bi->inst[4].NNN;
+	chip8->cycles -= done;
+	return false;
+}
+
+// Handler per opcode, per quirk profile
+#define BLOCK_HANDLERS(name, profile, quirks)	\
+	[profile] = {								\
+		[OP_INVALID]	= block_invalid,		\
+		[OP_CLS]		= block_cls,			\
+		[OP_RET]		= block_ret,			\
+		[OP_JP]			= block_jp,				\
+		[OP_JP_SELF]	= block_jp,				\
+		[OP_JP_WAIT]	= block_jp,				\
+		[OP_CALL]		= block_call,			\
+		[OP_SE_VX_NN]	= block_se_vx_nn,		\
+		[OP_SNE_VX_NN]	= block_sne_vx_nn,		\
+		[OP_SE_VX_VY]	= block_se_vx_vy,		\
+		[OP_LD_VX_NN]	= block_ld_vx_nn,		\
+		[OP_ADD_VX_NN]	= block_add_vx_nn,		\
+		[OP_LD_VX_VY]	= block_ld_vx_vy,		\
+		[OP_OR]			= block_or_##name,		\
+		[OP_AND]		= block_and_##name,		\
+		[OP_XOR]		= block_xor_##name,		\
+		[OP_ADD_VX_VY]	= block_add_vx_vy,		\
+		[OP_SUB]		= block_sub,			\
+		[OP_SHR]		= block_shr_##name,		\
+		[OP_SUBN]		= block_subn,			\
+		[OP_SHL]		= block_shl_##name,		\
+		[OP_SNE_VX_VY]	= block_sne_vx_vy,		\
+		[OP_LD_I_NNN]	= block_ld_i_nnn,		\
+		[OP_JP_V0]		= block_jp_v0_##name,	\
+		[OP_RND]		= block_rnd,			\
+		[OP_DRW]		= block_drw_##name,		\
+		[OP_SKP]		= block_skp,			\
+		[OP_SKNP]		= block_sknp,			\
+		[OP_LD_VX_DT]	= block_ld_vx_dt,		\
+		[OP_LD_VX_K]	= block_ld_vx_k,		\
+		[OP_LD_DT_VX]	= block_ld_dt_vx,		\
+		[OP_LD_ST_VX]	= block_ld_st_vx,		\
+		[OP_ADD_I_VX]	= block_add_i_vx,		\
+		[OP_LD_F_VX]	= block_ld_f_vx,		\
+		[OP_LD_B_VX]	= block_ld_b_vx,		\
+		[OP_LD_I_VX]	= block_ld_i_vx_##name,	\
+		[OP_LD_VX_I]	= block_ld_vx_i_##name,	\
+	},
+
+static const block_handler_t block_handlers[PROFILE_COUNT][OP_COUNT] = {
+	CHIP8_PROFILES(BLOCK_HANDLERS)
+};
+#undef BLOCK_HANDLERS
+
+// Mid-block handler per skip opcode, NULL for the rest
+static const block_handler_t block_skip_handlers[OP_COUNT] = {
+	[OP_SE_VX_NN]	= block_skip_se_vx_nn,
+	[OP_SNE_VX_NN]	= block_skip_sne_vx_nn,
+	[OP_SE_VX_VY]	= block_skip_se_vx_vy,
+	[OP_SNE_VX_VY]	= block_skip_sne_vx_vy,
+	[OP_SKP]		= block_skip_skp,
+	[OP_SKNP]		= block_skip_sknp,
+};
+
+// Fusable instruction sequences, longest first
+typedef struct {
+	uint8_t ops[3];		// opcode_t sequence
+	uint8_t len;
+	block_handler_t handler[PROFILE_COUNT];	// Per quirk profile
+} superinstruction_t;
+
+#define SUPER_PROFILES(handler) { handler, handler, handler }	// Same for every profile
+
+static const superinstruction_t superinstructions[] = {
+	{ { OP_LD_VX_NN, OP_LD_VX_NN, OP_DRW }, 3, { block_ld_ld_drw_chip8, block_ld_ld_drw_schip, block_ld_ld_drw_xochip } },
+	{ { OP_LD_I_NNN, OP_DRW }, 2, { block_ld_i_drw_chip8, block_ld_i_drw_schip, block_ld_i_drw_xochip } },
+	{ { OP_LD_VX_NN, OP_LD_VX_NN }, 2, SUPER_PROFILES(block_ld_ld) },
+	{ { OP_ADD_VX_NN, OP_SE_VX_NN, OP_JP }, 3, SUPER_PROFILES(block_add_se_jp) },
+	{ { OP_ADD_VX_NN, OP_SE_VX_NN, OP_JP_WAIT }, 3, SUPER_PROFILES(block_add_se_jp) },
+	{ { OP_ADD_VX_NN, OP_JP }, 2, SUPER_PROFILES(block_add_jp) },
+	{ { OP_ADD_VX_NN, OP_JP_WAIT }, 2, SUPER_PROFILES(block_add_jp) },
+};
+#undef SUPER_PROFILES
+
+// Instructions that end a block: they set PC themselves or write RAM that
+//	 the rest of the block may have been built from. Skips only end a block
+//	 when the instruction they skip does not fit in it.
+static bool block_is_branch(const uint8_t op) {
+	switch (op) {
+	case OP_JP:
+	case OP_JP_SELF:
+	case OP_JP_WAIT:
+	case OP_CALL:
+	case OP_RET:
+	case OP_SE_VX_NN:
+	case OP_SNE_VX_NN:
+	case OP_SE_VX_VY:
+	case OP_SNE_VX_VY:
+	case OP_JP_V0:
+	case OP_SKP:
+	case OP_SKNP:
+	case OP_LD_VX_K:
+	case OP_LD_B_VX:
+	case OP_LD_I_VX:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+// Drop every cached block
+static void block_cache_flush(block_cache_t *cache) {
+	cache->arena_used = 0;
+	memset(cache->blocks, 0, sizeof cache->blocks);
+	memset(cache->code_map, 0, sizeof cache->code_map);
+}
+
+// Code at pc can be cached: any page in a private cache, image pages in a
+//	 shared one, whose blocks stay valid for every machine of the image
+static inline bool block_cacheable(const block_cache_t *cache, const chip8_t *chip8, const uint16_t pc) {
+	const uint8_t p = pc >> CHIP8_PAGE_BITS;
+	return !cache->shared || chip8->page[p] == &chip8->image->pages[p];
+}
+
+// Block was built from the pages chip8 has now
+static inline bool block_valid(const cached_block_t *block, const chip8_t *chip8, const uint16_t start) {
+	return block->page_id[0] == chip8->page[start >> CHIP8_PAGE_BITS]->id &&
+		   block->page_id[1] == chip8->page[block->last_page]->id;
+}
+
+// Build the block starting at start. False if no code there can be cached.
+static bool block_build(block_cache_t *cache, const chip8_t *chip8, const uint16_t start, const profile_t profile) {
+	if (!block_cacheable(cache, chip8, start)) return false;
+	if (cache->arena_used + BLOCK_MAX_INSTS > BLOCK_ARENA_SIZE) block_cache_flush(cache);
+
+	cached_block_t *block = &cache->blocks[start];
+	block_inst_t *entry = &cache->arena[cache->arena_used];
+	uint16_t pc = start;
+	uint16_t count = 0;
+	bool branch = false;
+	bool skipped = false;	// Entry can be stepped over by the skip before it
+
+	*block = (cached_block_t){ .first = cache->arena_used };
+
+	while (!branch && pc <= 0x0FFE && count < BLOCK_MAX_INSTS && block_cacheable(cache, chip8, pc)) {
+		const instruction_t *inst = chip8_decoded(chip8, pc);
+		uint8_t len = 1;
+		bool skip = false;
+
+		entry->handler = block_handlers[profile][inst->op];
+		entry->inst = inst;
+
+		// Skips stay in the block as long as the instruction they skip fits
+		//	 in it too, as an entry of its own
+		if (block_skip_handlers[inst->op] && pc + 2 <= 0x0FFE && count + 2 <= BLOCK_MAX_INSTS &&
+			block_cacheable(cache, chip8, pc + 2)) {
+			entry->handler = block_skip_handlers[inst->op];
+			skip = true;
+		}
+
+		// Fuse with following instructions if they match a superinstruction
+		for (size_t s = 0; !skip && !skipped && s < sizeof superinstructions / sizeof superinstructions[0]; s++) {
+			const superinstruction_t *super = &superinstructions[s];
+			// Fused instructions are read at inst + 2, inst + 4: same page only
+			const uint16_t last = pc + 2 * (super->len - 1);
+			if (last > 0x0FFE || (last ^ pc) >> CHIP8_PAGE_BITS || count + super->len > BLOCK_MAX_INSTS) continue;
+
+			bool match = true;
+			for (uint8_t k = 0; k < super->len && match; k++) {
+				match = (inst[2 * k].op == super->ops[k]);
+			}
+			if (match) {
+				entry->handler = super->handler[profile];
+				len = super->len;
+				break;
+			}
+		}
+
+		branch = !skip && block_is_branch(inst[2 * (len - 1)].op);
+		skipped = skip;
+		block->last_page = pc >> CHIP8_PAGE_BITS;	// Fused instructions share a page
+		count += len;
+		pc += 2 * len;
+		entry->retired = count;
+		entry++;
+	}
+
+	const uint32_t entries = entry - &cache->arena[block->first];
+	block->page_id[0] = chip8->page[start >> CHIP8_PAGE_BITS]->id;
+	block->page_id[1] = chip8->page[block->last_page]->id;
+	block->body_len = branch ? entries - 1 : entries;
+	block->count = count;
+	block->end_pc = pc;
+	block->has_branch = branch;
+	cache->arena_used += entries;
+
+	// Writes to image pages copy them, which changes their ids instead
+	for (uint16_t a = start; a < pc; a++) {
+		if (chip8->page[a >> CHIP8_PAGE_BITS] != &chip8->image->pages[a >> CHIP8_PAGE_BITS]) cache->code_map[a] = true;
+	}
+	return true;
+}
+
+// Drop all cached blocks if the guest wrote to own page RAM they were built from
+static void block_check_ram_writes(block_cache_t *cache, chip8_t *chip8) {
+	if (!chip8->ram_written) return;
+	chip8->ram_written = false;
+
+	for (uint16_t addr = chip8->ram_write_lo; addr <= chip8->ram_write_hi; addr++) {
+		if (cache->code_map[addr]) {
+			block_cache_flush(cache);
+			return;
+		}
+	}
+}
+
+// Emulate count CHIP8 instructions with cached blocks
+static void block_run(block_cache_t *cache, chip8_t *chip8, const chip8_config_t config, uint64_t count) {
+	block_check_ram_writes(cache, chip8);	// RAM may have been restored from a snapshot since
+
+	while (count) {
+		count -= idle_skip(chip8, &config, count);	// Fast-forward idle loops
+		if (!count) return;
+
+		if (chip8->PC <= 0x0FFE) {
+			cached_block_t *block = &cache->blocks[chip8->PC];
+			const bool valid = block_valid(block, chip8, chip8->PC) ||
+							   block_build(cache, chip8, chip8->PC, config.profile);
+
+			// Only run whole blocks that fit the remaining budget
+			if (valid && block->count <= count) {
+				const block_inst_t *bi = &cache->arena[block->first];
+				const block_inst_t *body_end = bi + block->body_len;
+				const uint64_t start_cycles = chip8->cycles;
+
+				// A taken skip steps over the next entry, which retires nothing
+				for (; bi < body_end; bi++) {
+					if (bi->handler(chip8, bi, &config)) {
+						bi++;
+						chip8->cycles--;
+					}
+				}
+
+				// Branches see PC just past themselves, as in the interpreter,
+				//	 unless a skip just before stepped over the branch as well
+				chip8->PC = block->end_pc;
+				chip8->cycles += block->count;
+				if (block->has_branch && bi == body_end) bi->handler(chip8, bi, &config);
+
+				// Skips may retire fewer instructions than the block holds
+				count -= chip8->cycles - start_cycles;
+				block_check_ram_writes(cache, chip8);
+				continue;
+			}
+		}
+
+		run_instructions(chip8, config, 1);
+		count--;
+		block_check_ram_writes(cache, chip8);
+	}
+}
+
+// Quirks of each profile_t, for cores that check them at run or translation time
+#define PROFILE_QUIRKS(name, profile, quirks) [profile] = quirks,
+static const uint8_t profile_quirks[PROFILE_COUNT] = { CHIP8_PROFILES(PROFILE_QUIRKS) };
+#undef PROFILE_QUIRKS
+
+#ifdef CHIP8_JIT
+// x86-64 dynamic recompiler
+// Straight-line runs of supported opcodes are translated into a native block
+//	 with signature void block(chip8_t *chip8). Guest registers touched by the
+//	 block live in host registers, loaded on entry and stored back on exit.
+//	 A taken skip leaves the block early, at the instruction after the one it
+//	 skips. Instructions with more work than a few host instructions call out
+//	 to their C handlers, see jit_calls. Any other unsupported opcode ends the
+//	 block; it is then run by the interpreter.
+#define JIT_CODE_SIZE (1024 * 1024)	// Executable buffer size, flushed when full
+#define JIT_MAX_BLOCK 64			// Max instructions per translated block
+#define JIT_MAX_BLOCK_BYTES 4096	// Upper bound of native code per block
+
+// Upper bounds of native code, to keep a block within JIT_MAX_BLOCK_BYTES
+#define JIT_FRAME_BYTES 256			// Prologue and epilogue
+#define JIT_INST_BYTES 16			// Most instructions
+#define JIT_SKIP_BYTES 64			// Skip, with its exit stub
+#define JIT_CALL_BYTES 256			// Call out, storing and reloading every register around it
+
+typedef void (*jit_fn_t)(chip8_t *chip8);
+
+// Translated block starting at a RAM address
+typedef struct {
+	uint64_t page_id[2];	// Ids of the pages of its first and last instruction, 0 if not translated
+	jit_fn_t fn;			// Native code, NULL if first instruction is unsupported
+	uint16_t count;			// CHIP8 instructions covered by the block
+	uint8_t last_page;		// Page of its last instruction
+} jit_block_t;
+
+// Blocks are only run on a machine whose pages still have the ids they were
+//	 translated from, so one JIT can serve any machine; see core_share()
+struct jit {
+	uint8_t *code;					// RWX code buffer
+	size_t code_used;				// Bytes of code buffer in use
+	profile_t profile;				// Quirk profile the blocks were translated for
+	chip8_config_t config;			// Config of the current run, for handlers called out to
+	jit_block_t blocks[CHIP8_RAM_SIZE];		// Translated block per start address
+	bool code_map[CHIP8_RAM_SIZE];			// RAM byte is covered by a block translated from a machine's own page
+	bool shared;							// Only translate pages machines share with their image
+};
+
+// Host register numbers
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#ifdef _WIN32
+#define JIT_CTX RCX		// chip8_t * argument register
+#define JIT_ARG2 RDX	// Second and third argument registers, for calls out to C
+#define JIT_ARG3 R8
+#define JIT_SHADOW 32	// Stack the caller reserves for the callee's register arguments
+static const uint8_t jit_host_pool[] = { RAX, RDX, R8, R9, R10, R11, RBX, RSI, RDI, R12, R13, R14, R15 };
+static const bool jit_callee_saved[16] = { [RBX] = true, [RBP] = true, [RSI] = true, [RDI] = true,
+										   [R12] = true, [R13] = true, [R14] = true, [R15] = true };
+#else
+#define JIT_CTX RDI		// chip8_t * argument register
+#define JIT_ARG2 RSI	// Second and third argument registers, for calls out to C
+#define JIT_ARG3 RDX
+#define JIT_SHADOW 0	// Stack the caller reserves for the callee's register arguments
+static const uint8_t jit_host_pool[] = { RAX, RCX, RDX, RSI, R8, R9, R10, R11, RBX, R12, R13, R14, R15 };
+static const bool jit_callee_saved[16] = { [RBX] = true, [RBP] = true,
+										   [R12] = true, [R13] = true, [R14] = true, [R15] = true };
+#endif
+#define JIT_SCRATCH RBP	// Temporary for flags, shifts and key tests, never a guest register
+
+static void jit_emit8(jit_t *jit, const uint8_t byte) {
+	jit->code[jit->code_used++] = byte;
+}
+
+static void jit_emit16(jit_t *jit, const uint16_t value) {
+	jit_emit8(jit, value & 0xFF);
+	jit_emit8(jit, value >> 8);
+}
+
+static void jit_emit32(jit_t *jit, const uint32_t value) {
+	jit_emit16(jit, value & 0xFFFF);
+	jit_emit16(jit, value >> 16);
+}
+
+// [ctx + disp32] memory operand with reg field
+static void jit_emit_mem(jit_t *jit, const uint8_t reg, const size_t disp) {
+	jit_emit8(jit, 0x80 | (reg & 7) << 3 | JIT_CTX);
+	jit_emit32(jit, (uint32_t)disp);
+}
+
+// REX prefix for a register-direct operation, always emitted so that byte
+//	 registers 4-7 are spl..dil rather than ah..bh
+static void jit_emit_rex(jit_t *jit, const uint8_t reg, const uint8_t rm) {
+	jit_emit8(jit, 0x40 | (reg >= R8 ? 0x04 : 0) | (rm >= R8 ? 0x01 : 0));
+}
+
+// Register-direct ModRM: reg is the source or opcode extension, rm the operand
+static void jit_emit_modrm(jit_t *jit, const uint8_t reg, const uint8_t rm) {
+	jit_emit8(jit, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// op r/m, r with a one byte opcode
+static void jit_emit_rr(jit_t *jit, const uint8_t opcode, const uint8_t reg, const uint8_t rm) {
+	jit_emit_rex(jit, reg, rm);
+	jit_emit8(jit, opcode);
+	jit_emit_modrm(jit, reg, rm);
+}
+
+// setc/setnc r8
+static void jit_emit_setcc(jit_t *jit, const uint8_t cc, const uint8_t r) {
+	jit_emit_rex(jit, 0, r);
+	jit_emit8(jit, 0x0F);
+	jit_emit8(jit, 0x90 | cc);
+	jit_emit_modrm(jit, 0, r);
+}
+
+// Load every guest register the block keeps in a host register
+static void jit_emit_load_regs(jit_t *jit, const int8_t *host_of) {
+	for (uint8_t x = 0; x < 16; x++) {
+		if (host_of[x] < 0) continue;
+		const uint8_t r = host_of[x];
+		if (r >= R8) jit_emit8(jit, 0x44);
+		jit_emit8(jit, 0x0F);
+		jit_emit8(jit, 0xB6);							// movzx r32, byte [ctx + V + x]
+		jit_emit_mem(jit, r, offsetof(chip8_t, V) + x);
+	}
+}
+
+// Store them back. Guest registers are 8-bit; only the low byte of the host
+//	 register is stored, so adds need no masking.
+static void jit_emit_store_regs(jit_t *jit, const int8_t *host_of) {
+	for (uint8_t x = 0; x < 16; x++) {
+		if (host_of[x] < 0) continue;
+		const uint8_t r = host_of[x];
+		jit_emit8(jit, 0x40 | (r >= R8 ? 0x04 : 0));	// REX so 4-7 encode spl..dil
+		jit_emit8(jit, 0x88);							// mov byte [ctx + V + x], r8
+		jit_emit_mem(jit, r, offsetof(chip8_t, V) + x);
+	}
+}
+
+// Set PC and count the instructions retired on the way out of a block
+static void jit_emit_exit_state(jit_t *jit, const uint16_t pc, const uint16_t retired) {
+	jit_emit8(jit, 0x66);
+	jit_emit8(jit, 0xC7);								// mov word [ctx + PC], imm16
+	jit_emit_mem(jit, 0, offsetof(chip8_t, PC));
+	jit_emit16(jit, pc);
+	jit_emit8(jit, 0x48);
+	jit_emit8(jit, 0x81);								// add qword [ctx + cycles], imm32
+	jit_emit_mem(jit, 0, offsetof(chip8_t, cycles));
+	jit_emit32(jit, retired);
+}
+
+// Handlers called out to from translated code: arg is the opcode, plus the
+//	 block's instructions retired up to this one in the upper half. The block
+//	 stores its guest registers to chip8->V before the call and reloads them
+//	 after, so handlers see and update the machine as the interpreter does.
+typedef void (*jit_call_t)(chip8_t *chip8, const uint32_t arg, const chip8_config_t *config);
+
+// Operand fields of arg's opcode, all that handlers read
+static inline instruction_t jit_inst(const uint32_t arg) {
+	const uint16_t opcode = arg & 0xFFFF;
+	return (instruction_t){
+		.opcode = opcode,
+		.NNN = opcode & 0x0FFF,
+		.NN = opcode & 0x0FF,
+		.N = opcode & 0x0F,
+		.X = (opcode >> 8) & 0x0F,
+		.Y = (opcode >> 4) & 0x0F,
+	};
+}
+
+#define JIT_CALL(name)																	\
+	static void jit_##name(chip8_t *chip8, const uint32_t arg, const chip8_config_t *config) {	\
+		const instruction_t inst = jit_inst(arg);										\
+		exec_##name(chip8, &inst, config);												\
+	}
+
+// Timer instructions run where chip8->cycles is still the count at block
+//	 start, so step it to their own cycle
+#define JIT_TIMER_CALL(name)															\
+	static void jit_##name(chip8_t *chip8, const uint32_t arg, const chip8_config_t *config) {	\
+		const instruction_t inst = jit_inst(arg);										\
+		chip8->cycles += arg >> 16;														\
+		exec_##name(chip8, &inst, config);												\
+		chip8->cycles -= arg >> 16;														\
+	}
+
+JIT_CALL(cls)
+JIT_CALL(rnd)
+JIT_CALL(ld_f_vx)
+JIT_CALL(ld_b_vx)
+JIT_TIMER_CALL(ld_vx_dt)
+JIT_TIMER_CALL(ld_dt_vx)
+JIT_TIMER_CALL(ld_st_vx)
+#undef JIT_TIMER_CALL
+#undef JIT_CALL
+
+// Quirky instructions, one specialized copy per profile
+#define JIT_QUIRK_CALL(name, profile, quirks, op)										\
+	static void jit_##op##_##name(chip8_t *chip8, const uint32_t arg, const chip8_config_t *config) {	\
+		const instruction_t inst = jit_inst(arg);										\
+		exec_##op(chip8, &inst, config, quirks);										\
+	}
+
+#define JIT_QUIRK_CALLS(name, profile, quirks)		\
+	JIT_QUIRK_CALL(name, profile, quirks, drw)		\
+	JIT_QUIRK_CALL(name, profile, quirks, ld_i_vx)	\
+	JIT_QUIRK_CALL(name, profile, quirks, ld_vx_i)
+
+CHIP8_PROFILES(JIT_QUIRK_CALLS)
+#undef JIT_QUIRK_CALLS
+#undef JIT_QUIRK_CALL
+
+// Handler called out to per opcode, per quirk profile. NULL for the opcodes
+//	 translated inline and for those left to the interpreter.
+#define JIT_CALLS(name, profile, quirks)		\
+	[profile] = {								\
+		[OP_CLS]		= jit_cls,				\
+		[OP_RND]		= jit_rnd,				\
+		[OP_DRW]		= jit_drw_##name,		\
+		[OP_LD_VX_DT]	= jit_ld_vx_dt,			\
+		[OP_LD_DT_VX]	= jit_ld_dt_vx,			\
+		[OP_LD_ST_VX]	= jit_ld_st_vx,			\
+		[OP_LD_F_VX]	= jit_ld_f_vx,			\
+		[OP_LD_B_VX]	= jit_ld_b_vx,			\
+		[OP_LD_I_VX]	= jit_ld_i_vx_##name,	\
+		[OP_LD_VX_I]	= jit_ld_vx_i_##name,	\
+	},
+
+static const jit_call_t jit_calls[PROFILE_COUNT][OP_COUNT] = {
+	CHIP8_PROFILES(JIT_CALLS)
+};
+#undef JIT_CALLS
+
+// Call out to handler with every guest register in chip8->V, and the stack
+//	 16-byte aligned: the return address, the saved_count pushes of the
+//	 prologue, and ctx, which is caller-saved
+static void jit_emit_call(jit_t *jit, const jit_call_t handler, const uint32_t arg,
+						  const int8_t *host_of, const uint8_t saved_count) {
+	const uint8_t frame = ((saved_count & 1) ? 8 : 0) + JIT_SHADOW;
+	const uint64_t fn = (uint64_t)(uintptr_t)handler;
+	const uint64_t config = (uint64_t)(uintptr_t)&jit->config;
+
+	jit_emit_store_regs(jit, host_of);
+	jit_emit8(jit, 0x50 + JIT_CTX);				// push ctx
+	if (frame) {
+		jit_emit8(jit, 0x48);
+		jit_emit8(jit, 0x83);					// sub rsp, imm8
+		jit_emit8(jit, 0xEC);
+		jit_emit8(jit, frame);
+	}
+	jit_emit8(jit, 0xB8 + JIT_ARG2);			// mov arg2, imm32
+	jit_emit32(jit, arg);
+	jit_emit8(jit, 0x48 | (JIT_ARG3 >= R8 ? 0x01 : 0));
+	jit_emit8(jit, 0xB8 + (JIT_ARG3 & 7));		// mov arg3, imm64
+	jit_emit32(jit, config & 0xFFFFFFFF);
+	jit_emit32(jit, config >> 32);
+	jit_emit8(jit, 0x48);
+	jit_emit8(jit, 0xB8);						// mov rax, imm64
+	jit_emit32(jit, fn & 0xFFFFFFFF);
+	jit_emit32(jit, fn >> 32);
+	jit_emit8(jit, 0xFF);
+	jit_emit8(jit, 0xD0);						// call rax
+	if (frame) {
+		jit_emit8(jit, 0x48);
+		jit_emit8(jit, 0x83);					// add rsp, imm8
+		jit_emit8(jit, 0xC4);
+		jit_emit8(jit, frame);
+	}
+	jit_emit8(jit, 0x58 + JIT_CTX);				// pop ctx
+	jit_emit_load_regs(jit, host_of);			// Whatever the handler wrote, and the caller-saved ones
+}
+
+static jit_t *jit_create(void) {
+	jit_t *jit = calloc(1, sizeof *jit);
+	if (!jit) return NULL;
+
+#ifdef _WIN32
+	jit->code = VirtualAlloc(NULL, JIT_CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+	jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+					 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit->code == MAP_FAILED) jit->code = NULL;
+#endif
+
+	if (!jit->code) {
+		chip8_log("Could not allocate executable memory for JIT\n");
+		free(jit);
+		return NULL;
+	}
+
+	return jit;
+}
+
+static void jit_destroy(jit_t *jit) {
+	if (!jit) return;
+#ifdef _WIN32
+	VirtualFree(jit->code, 0, MEM_RELEASE);
+#else
+	munmap(jit->code, JIT_CODE_SIZE);
+#endif
+	free(jit);
+}
+
+// Drop every translated block
+static void jit_flush(jit_t *jit) {
+	jit->code_used = 0;
+	memset(jit->blocks, 0, sizeof jit->blocks);
+	memset(jit->code_map, 0, sizeof jit->code_map);
+}
+
+// Guest registers a translated instruction keeps in host registers, a bit
+//	 per V register. False if the instruction is not translated.
+static bool jit_inst_regs(const instruction_t *inst, const profile_t profile, uint16_t *regs) {
+	const uint8_t quirks = profile_quirks[profile];
+	const uint16_t x = 1u << inst->X;
+	const uint16_t y = 1u << inst->Y;
+	const uint16_t f = 1u << 0xF;
+
+	if (jit_calls[profile][inst->op]) {
+		*regs = 0;	// Handlers use chip8->V
+		return true;
+	}
+
+	switch (inst->op) {
+	case OP_JP:
+	case OP_JP_WAIT:
+	case OP_LD_I_NNN:	*regs = 0; return true;
+	case OP_LD_VX_NN:
+	case OP_ADD_VX_NN:
+	case OP_SE_VX_NN:
+	case OP_SNE_VX_NN:
+	case OP_SKP:
+	case OP_SKNP:
+	case OP_ADD_I_VX:	*regs = x; return true;
+	case OP_LD_VX_VY:
+	case OP_SE_VX_VY:
+	case OP_SNE_VX_VY:	*regs = x | y; return true;
+	case OP_OR:
+	case OP_AND:
+	case OP_XOR:		*regs = x | y | ((quirks & QUIRK_VF_RESET) ? f : 0); return true;
+	case OP_ADD_VX_VY:
+	case OP_SUB:
+	case OP_SUBN:		*regs = x | y | f; return true;
+	case OP_SHR:
+	case OP_SHL:		*regs = x | ((quirks & QUIRK_SHIFT_VY) ? y : 0) | f; return true;
+	default:			return false;
+	}
+}
+
+// A skip exits the block when taken: jump to patch, then PC and cycles to set
+typedef struct {
+	size_t jump;		// Code offset of the jump's rel32
+	uint16_t pc;		// Instruction after the skipped one
+	uint16_t retired;	// Instructions retired up to and including the skip
+} jit_exit_t;
+
+// Code at addr can be translated: any page in a private JIT, image pages in
+//	 a shared one, whose blocks stay valid for every machine of the image
+static inline bool jit_translatable(const jit_t *jit, const chip8_t *chip8, const uint16_t addr) {
+	const uint8_t p = addr >> CHIP8_PAGE_BITS;
+	return !jit->shared || chip8->page[p] == &chip8->image->pages[p];
+}
+
+// Block was translated from the pages chip8 has now
+static inline bool jit_block_valid(const jit_block_t *block, const chip8_t *chip8, const uint16_t start) {
+	return block->page_id[0] == chip8->page[start >> CHIP8_PAGE_BITS]->id &&
+		   block->page_id[1] == chip8->page[block->last_page]->id;
+}
+
+// Translate the block starting at start. False if no code there can be.
+static bool jit_translate(jit_t *jit, const chip8_t *chip8, const uint16_t start, const profile_t profile) {
+	const uint8_t quirks = profile_quirks[profile];
+	int8_t host_of[16];			// Host register holding each guest V register, -1 if none
+	uint8_t pool_used = 0;
+	bool scratch = false;		// JIT_SCRATCH is used, and saved
+	size_t bytes = JIT_FRAME_BYTES;
+	uint16_t count = 0;
+	uint16_t addr = start;
+	uint16_t end_pc;
+
+	memset(host_of, -1, sizeof host_of);
+
+	if (!jit_translatable(jit, chip8, start)) return false;
+
+	// Pass 1: find the supported run and assign host registers
+	for (;;) {
+		if (addr > 0x0FFE || count == JIT_MAX_BLOCK || !jit_translatable(jit, chip8, addr)) {
+			end_pc = addr;
+			break;
+		}
+
+		const instruction_t *inst = chip8_decoded(chip8, addr);
+		uint16_t regs;
+		if (!jit_inst_regs(inst, profile, &regs)) {
+			end_pc = addr;	// Unsupported, leave it to the interpreter
+			break;
+		}
+
+		const bool skip = (inst->op == OP_SE_VX_NN || inst->op == OP_SNE_VX_NN || inst->op == OP_SE_VX_VY ||
+						   inst->op == OP_SNE_VX_VY || inst->op == OP_SKP || inst->op == OP_SKNP);
+		bytes += jit_calls[profile][inst->op] ? JIT_CALL_BYTES : skip ? JIT_SKIP_BYTES : JIT_INST_BYTES;
+
+		uint8_t needed = 0;
+		for (uint8_t x = 0; x < 16; x++) needed += ((regs >> x) & 1) && host_of[x] < 0;
+		if (pool_used + needed > sizeof jit_host_pool || bytes > JIT_MAX_BLOCK_BYTES) {
+			end_pc = addr;
+			break;
+		}
+		for (uint8_t x = 0; x < 16; x++) {
+			if (((regs >> x) & 1) && host_of[x] < 0) host_of[x] = jit_host_pool[pool_used++];
+		}
+		scratch |= (inst->op == OP_SUBN || inst->op == OP_SHR || inst->op == OP_SHL ||
+					inst->op == OP_SKP || inst->op == OP_SKNP || inst->op == OP_ADD_I_VX);
+
+		count++;
+		if (inst->op == OP_JP || inst->op == OP_JP_WAIT) {
+			end_pc = inst->NNN;
+			break;
+		}
+		addr += 2;
+
+		// RAM writes end the block, which may have been built from that RAM
+		if (inst->op == OP_LD_B_VX || inst->op == OP_LD_I_VX) {
+			end_pc = addr;
+			break;
+		}
+	}
+
+	const uint8_t first_page = start >> CHIP8_PAGE_BITS;
+	const uint8_t last_page = (start + 2 * (count ? count - 1 : 0)) >> CHIP8_PAGE_BITS;
+	const uint64_t page_id[2] = { chip8->page[first_page]->id, chip8->page[last_page]->id };
+
+	if (count == 0) {
+		jit->blocks[start] = (jit_block_t){ .page_id = { page_id[0], page_id[1] }, .fn = NULL, .count = 0,
+											.last_page = last_page };
+		return true;
+	}
+
+	if (jit->code_used + JIT_MAX_BLOCK_BYTES > JIT_CODE_SIZE) jit_flush(jit);
+
+	uint8_t *entry = &jit->code[jit->code_used];
+	uint8_t saved[16];			// Callee-saved host registers pushed by the prologue
+	uint8_t saved_count = 0;
+	jit_exit_t exits[JIT_MAX_BLOCK];
+	uint8_t exit_count = 0;
+
+	for (uint8_t i = 0; i < pool_used; i++) {
+		if (jit_callee_saved[jit_host_pool[i]]) saved[saved_count++] = jit_host_pool[i];
+	}
+	if (scratch) saved[saved_count++] = JIT_SCRATCH;
+
+	// Prologue: save callee-saved host registers we use, load guest registers.
+	//	 Every one is loaded, so that any exit can store them all back.
+	for (uint8_t i = 0; i < saved_count; i++) {
+		if (saved[i] >= R8) jit_emit8(jit, 0x41);
+		jit_emit8(jit, 0x50 + (saved[i] & 7));			// push r64
+	}
+	jit_emit_load_regs(jit, host_of);
+
+	// Body
+	for (uint16_t i = 0, pc = start; i < count; i++, pc += 2) {
+		const instruction_t *inst = chip8_decoded(chip8, pc);
+		const uint8_t rx = host_of[inst->X];
+		const uint8_t ry = host_of[inst->Y];
+		const uint8_t rf = host_of[0xF];
+		uint8_t taken = 0;		// Condition code of a skip being taken
+
+		switch (inst->op) {
+		case OP_LD_VX_NN:
+			if (rx >= R8) jit_emit8(jit, 0x41);
+			jit_emit8(jit, 0xB8 + (rx & 7));			// mov r32, imm32
+			jit_emit32(jit, inst->NN);
+			break;
+
+		case OP_ADD_VX_NN:
+			if (rx >= R8) jit_emit8(jit, 0x41);
+			jit_emit8(jit, 0x81);
+			jit_emit8(jit, 0xC0 | (rx & 7));			// add r32, imm32
+			jit_emit32(jit, inst->NN);
+			break;
+
+		case OP_LD_I_NNN:
+			jit_emit8(jit, 0x66);
+			jit_emit8(jit, 0xC7);						// mov word [ctx + I], imm16
+			jit_emit_mem(jit, 0, offsetof(chip8_t, I));
+			jit_emit16(jit, inst->NNN);
+			break;
+
+		// 8XY_: byte operations, so the carry flag is the guest's VF. VF is
+		//	 set last, as in the interpreter, so it holds the flag when X is F.
+		case OP_LD_VX_VY:
+			jit_emit_rr(jit, 0x89, ry, rx);				// mov r32, r32
+			break;
+
+		case OP_OR:
+		case OP_AND:
+		case OP_XOR:
+			jit_emit_rr(jit, inst->op == OP_OR ? 0x08 : inst->op == OP_AND ? 0x20 : 0x30, ry, rx);	// or/and/xor r8, r8
+			if (quirks & QUIRK_VF_RESET) {
+				if (rf >= R8) jit_emit8(jit, 0x41);
+				jit_emit8(jit, 0xB8 + (rf & 7));		// mov r32, 0
+				jit_emit32(jit, 0);
+			}
+			break;
+
+		case OP_ADD_VX_VY:
+			jit_emit_rr(jit, 0x00, ry, rx);				// add r8, r8
+			jit_emit_setcc(jit, 0x2, rf);				// setc: carry
+			break;
+
+		case OP_SUB:
+			jit_emit_rr(jit, 0x28, ry, rx);				// sub r8, r8
+			jit_emit_setcc(jit, 0x3, rf);				// setnc: no borrow
+			break;
+
+		case OP_SUBN:
+			jit_emit_rr(jit, 0x89, ry, JIT_SCRATCH);	// mov scratch, VY
+			jit_emit_rr(jit, 0x28, rx, JIT_SCRATCH);	// sub scratch8, VX
+			jit_emit_rr(jit, 0x89, JIT_SCRATCH, rx);
+			jit_emit_setcc(jit, 0x3, rf);
+			break;
+
+		case OP_SHR:
+		case OP_SHL:
+			jit_emit_rr(jit, 0x89, (quirks & QUIRK_SHIFT_VY) ? ry : rx, JIT_SCRATCH);
+			jit_emit_rex(jit, 0, JIT_SCRATCH);
+			jit_emit8(jit, 0xD0);						// shr/shl r8, 1: bit shifted out in carry
+			jit_emit_modrm(jit, inst->op == OP_SHR ? 5 : 4, JIT_SCRATCH);
+			jit_emit_rr(jit, 0x89, JIT_SCRATCH, rx);
+			jit_emit_setcc(jit, 0x2, rf);
+			break;
+
+		// Skips compare, then leave the block if taken
+		case OP_SE_VX_NN:
+		case OP_SNE_VX_NN:
+			jit_emit_rex(jit, 0, rx);
+			jit_emit8(jit, 0x80);						// cmp r8, imm8
+			jit_emit_modrm(jit, 7, rx);
+			jit_emit8(jit, inst->NN);
+			taken = (inst->op == OP_SE_VX_NN) ? 0x4 : 0x5;	// je/jne
+			break;
+
+		case OP_SE_VX_VY:
+		case OP_SNE_VX_VY:
+			jit_emit_rr(jit, 0x38, ry, rx);				// cmp r8, r8
+			taken = (inst->op == OP_SE_VX_VY) ? 0x4 : 0x5;
+			break;
+
+		case OP_SKP:
+		case OP_SKNP:
+			jit_emit_rex(jit, JIT_SCRATCH, rx);
+			jit_emit8(jit, 0x0F);
+			jit_emit8(jit, 0xB6);						// movzx scratch, VX
+			jit_emit_modrm(jit, JIT_SCRATCH, rx);
+			jit_emit_rex(jit, 0, JIT_SCRATCH);
+			jit_emit8(jit, 0x83);						// and scratch, imm8
+			jit_emit_modrm(jit, 4, JIT_SCRATCH);
+			jit_emit8(jit, 0x0F);
+			jit_emit8(jit, 0x66);
+			if (JIT_SCRATCH >= R8) jit_emit8(jit, 0x44);
+			jit_emit8(jit, 0x0F);
+			jit_emit8(jit, 0xA3);						// bt word [ctx + keypad], scratch16: key down in carry
+			jit_emit_mem(jit, JIT_SCRATCH, offsetof(chip8_t, keypad));
+			taken = (inst->op == OP_SKP) ? 0x2 : 0x3;	// jc/jnc
+			break;
+
+		case OP_ADD_I_VX:
+			jit_emit_rex(jit, JIT_SCRATCH, rx);
+			jit_emit8(jit, 0x0F);
+			jit_emit8(jit, 0xB6);						// movzx scratch, VX
+			jit_emit_modrm(jit, JIT_SCRATCH, rx);
+			jit_emit8(jit, 0x66);
+			jit_emit8(jit, 0x01);						// add word [ctx + I], scratch16
+			jit_emit_mem(jit, JIT_SCRATCH, offsetof(chip8_t, I));
+			break;
+
+		default:
+			// OP_JP/OP_JP_WAIT are handled by the epilogue PC store
+			if (jit_calls[profile][inst->op]) {
+				jit_emit_call(jit, jit_calls[profile][inst->op], inst->opcode | (uint32_t)(i + 1) << 16, host_of, saved_count);
+			}
+			break;
+		}
+
+		if (taken) {
+			jit_emit8(jit, 0x0F);
+			jit_emit8(jit, 0x80 | taken);				// jcc rel32 to the exit, patched below
+			exits[exit_count++] = (jit_exit_t){ .jump = jit->code_used, .pc = pc + 4, .retired = i + 1 };
+			jit_emit32(jit, 0);
+		}
+	}
+
+	// Epilogue: PC and cycle count, then store guest registers and restore host registers
+	jit_emit_exit_state(jit, end_pc, count);
+	const size_t epilogue = jit->code_used;
+	jit_emit_store_regs(jit, host_of);
+	for (int i = saved_count - 1; i >= 0; i--) {
+		if (saved[i] >= R8) jit_emit8(jit, 0x41);
+		jit_emit8(jit, 0x58 + (saved[i] & 7));			// pop r64
+	}
+	jit_emit8(jit, 0xC3);								// ret
+
+	// Exits of taken skips, out of line
+	for (uint8_t e = 0; e < exit_count; e++) {
+		const uint32_t rel = (uint32_t)(jit->code_used - (exits[e].jump + 4));
+		memcpy(&jit->code[exits[e].jump], &rel, sizeof rel);
+		jit_emit_exit_state(jit, exits[e].pc, exits[e].retired);
+		jit_emit8(jit, 0xE9);							// jmp rel32 to the epilogue
+		jit_emit32(jit, (uint32_t)(epilogue - (jit->code_used + 4)));
+	}
+
+	jit->blocks[start] = (jit_block_t){ .page_id = { page_id[0], page_id[1] }, .fn = (jit_fn_t)(void *)entry,
+										.count = count, .last_page = last_page };
+
+	// Writes to image pages copy them, which changes their ids instead
+	for (uint16_t a = start; a < start + 2 * count; a++) {
+		if (chip8->page[a >> CHIP8_PAGE_BITS] != &chip8->image->pages[a >> CHIP8_PAGE_BITS]) jit->code_map[a] = true;
+	}
+	return true;
+}
+
+// Drop all translations if the guest wrote to own page RAM they were built from
+static void jit_check_ram_writes(jit_t *jit, chip8_t *chip8) {
+	if (!chip8->ram_written) return;
+	chip8->ram_written = false;
+
+	for (uint16_t addr = chip8->ram_write_lo; addr <= chip8->ram_write_hi; addr++) {
+		if (jit->code_map[addr]) {
+			jit_flush(jit);
+			return;
+		}
+	}
+}
+
+// Emulate count CHIP8 instructions with translated blocks where possible
+static void jit_run(jit_t *jit, chip8_t *chip8, const chip8_config_t config, uint64_t count) {
+	jit_check_ram_writes(jit, chip8);	// RAM may have been restored from a snapshot since
+
+	// Blocks have the profile's quirks built in
+	if (jit->profile != config.profile) {
+		jit_flush(jit);
+		jit->profile = config.profile;
+	}
+	jit->config = config;
+
+	while (count) {
+		count -= idle_skip(chip8, &config, count);	// Fast-forward idle loops
+		if (!count) return;
+
+		if (chip8->PC <= 0x0FFE) {
+			jit_block_t *block = &jit->blocks[chip8->PC];
+			const bool valid = jit_block_valid(block, chip8, chip8->PC) ||
+							   jit_translate(jit, chip8, chip8->PC, config.profile);
+
+			// Only run whole blocks that fit the remaining budget
+			if (valid && block->fn && block->count <= count) {
+				const uint64_t start_cycles = chip8->cycles;
+				block->fn(chip8);
+				count -= chip8->cycles - start_cycles;	// Taken skips leave early
+				jit_check_ram_writes(jit, chip8);
+				continue;
+			}
+		}
+
+		// Unsupported instruction: interpret it, it may have written RAM
+		run_instructions(chip8, config, 1);
+		count--;
+		jit_check_ram_writes(jit, chip8);
+	}
+}
+#endif
+
+bool init_core(core_state_t *core, const chip8_config_t config) {
+	*core = (core_state_t){0};
+
+	if (config.core == CORE_JIT) {
+#ifdef CHIP8_JIT
+		core->jit = jit_create();
+		if (!core->jit) chip8_log("Falling back to interpreter core\n");
+#else
+		chip8_log("JIT is not supported on this host, using interpreter core\n");
+#endif
+	} else if (config.core == CORE_BLOCK) {
+		core->block_cache = calloc(1, sizeof *core->block_cache);
+		if (!core->block_cache) chip8_log("Could not allocate block cache, falling back to interpreter core\n");
+	}
+
+	return true;
+}
+
+// Have a core run many machines of one image in turn: it only caches code
+//	 in pages they still share with the image, which every one of them can run
+static void core_share(core_state_t *core) {
+#ifdef CHIP8_JIT
+	if (core->jit) core->jit->shared = true;
+#endif
+	if (core->block_cache) core->block_cache->shared = true;
+}
+
+void destroy_core(core_state_t *core) {
+#ifdef CHIP8_JIT
+	jit_destroy(core->jit);
+#endif
+	free(core->block_cache);
+}
+
+// Emulate count CHIP8 instructions on the selected core
+void run_core(core_state_t *core, chip8_t *chip8, const chip8_config_t config, const uint64_t count) {
+#ifdef CHIP8_JIT
+	if (core->jit) {
+		jit_run(core->jit, chip8, config, count);
+		return;
+	}
+#endif
+	if (core->block_cache) {
+		block_run(core->block_cache, chip8, config, count);
+		return;
+	}
+	run_instructions(chip8, config, count);
+}
+
+// Name of the core actually in use, for reports
+const char *core_name(const core_state_t *core) {
+#ifdef CHIP8_JIT
+	if (core->jit) return "jit";
+#endif
+	if (core->block_cache) return "block";
+#if defined(__GNUC__) && !defined(CHIP8_SWITCH_DISPATCH)
+	return "interp (threaded)";
+#else
+	return "interp (switch)";
+#endif
+}
+
+// Lockstep batch core
+// Runs many instances of one ROM as a structure of arrays: each register,
+//	 timer and display row of every instance ("lane") is stored contiguously,
+//	 so an instruction is run on every lane at the same PC with vector ops.
+//	 Lanes that branch differently split into groups by PC; the group of the
+//	 lane furthest behind runs next, ties to the lowest PC, which lets lanes
+//	 that drifted apart in a loop fall back into step. A group runs with one
+//	 scalar PC for as long as its lanes agree on it, and lanes split by a skip
+//	 run the skipped instruction while the others wait, rather than regroup.
+
+// Byte lane vectors: as many V register lanes as the widest vector unit the
+//	 build targets handles at once. Masks are 0xFF in selected lanes, 0 elsewhere.
+#if defined(__AVX2__)
+#define LANES 32
+#define LANES_ISA "avx2"
+typedef __m256i lanes_t;
+static inline lanes_t lanes_load(const uint8_t *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline void lanes_store(uint8_t *p, const lanes_t v) { _mm256_storeu_si256((__m256i *)p, v); }
+static inline lanes_t lanes_set(const uint8_t b) { return _mm256_set1_epi8((char)b); }
+static inline lanes_t lanes_add(const lanes_t a, const lanes_t b) { return _mm256_add_epi8(a, b); }
+static inline lanes_t lanes_sub(const lanes_t a, const lanes_t b) { return _mm256_sub_epi8(a, b); }
+static inline lanes_t lanes_and(const lanes_t a, const lanes_t b) { return _mm256_and_si256(a, b); }
+static inline lanes_t lanes_or(const lanes_t a, const lanes_t b) { return _mm256_or_si256(a, b); }
+static inline lanes_t lanes_xor(const lanes_t a, const lanes_t b) { return _mm256_xor_si256(a, b); }
+static inline lanes_t lanes_eq(const lanes_t a, const lanes_t b) { return _mm256_cmpeq_epi8(a, b); }
+static inline lanes_t lanes_max(const lanes_t a, const lanes_t b) { return _mm256_max_epu8(a, b); }
+static inline lanes_t lanes_shr1(const lanes_t a) { return lanes_and(_mm256_srli_epi16(a, 1), lanes_set(0x7F)); }
+static inline lanes_t lanes_shr7(const lanes_t a) { return lanes_and(_mm256_srli_epi16(a, 7), lanes_set(0x01)); }
+static inline lanes_t lanes_select(const lanes_t m, const lanes_t a, const lanes_t b) { return _mm256_blendv_epi8(b, a, m); }
+static inline bool lanes_any(const lanes_t m) { return _mm256_movemask_epi8(m) != 0; }
+#elif defined(__SSE2__) || defined(_M_X64)
+#define LANES 16
+#define LANES_ISA "sse2"
+typedef __m128i lanes_t;
+static inline lanes_t lanes_load(const uint8_t *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void lanes_store(uint8_t *p, const lanes_t v) { _mm_storeu_si128((__m128i *)p, v); }
+static inline lanes_t lanes_set(const uint8_t b) { return _mm_set1_epi8((char)b); }
+static inline lanes_t lanes_add(const lanes_t a, const lanes_t b) { return _mm_add_epi8(a, b); }
+static inline lanes_t lanes_sub(const lanes_t a, const lanes_t b) { return _mm_sub_epi8(a, b); }
+static inline lanes_t lanes_and(const lanes_t a, const lanes_t b) { return _mm_and_si128(a, b); }
+static inline lanes_t lanes_or(const lanes_t a, const lanes_t b) { return _mm_or_si128(a, b); }
+static inline lanes_t lanes_xor(const lanes_t a, const lanes_t b) { return _mm_xor_si128(a, b); }
+static inline lanes_t lanes_eq(const lanes_t a, const lanes_t b) { return _mm_cmpeq_epi8(a, b); }
+static inline lanes_t lanes_max(const lanes_t a, const lanes_t b) { return _mm_max_epu8(a, b); }
+static inline lanes_t lanes_shr1(const lanes_t a) { return lanes_and(_mm_srli_epi16(a, 1), lanes_set(0x7F)); }
+static inline lanes_t lanes_shr7(const lanes_t a) { return lanes_and(_mm_srli_epi16(a, 7), lanes_set(0x01)); }
+static inline lanes_t lanes_select(const lanes_t m, const lanes_t a, const lanes_t b) {
+	return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+static inline bool lanes_any(const lanes_t m) { return _mm_movemask_epi8(m) != 0; }
+#else
+#define LANES 1		// No vector unit known: one lane at a time
+#define LANES_ISA "scalar"
+typedef uint8_t lanes_t;
+static inline lanes_t lanes_load(const uint8_t *p) { return *p; }
+static inline void lanes_store(uint8_t *p, const lanes_t v) { *p = v; }
+static inline lanes_t lanes_set(const uint8_t b) { return b; }
+static inline lanes_t lanes_add(const lanes_t a, const lanes_t b) { return a + b; }
+static inline lanes_t lanes_sub(const lanes_t a, const lanes_t b) { return a - b; }
+static inline lanes_t lanes_and(const lanes_t a, const lanes_t b) { return a & b; }
+static inline lanes_t lanes_or(const lanes_t a, const lanes_t b) { return a | b; }
+static inline lanes_t lanes_xor(const lanes_t a, const lanes_t b) { return a ^ b; }
+static inline lanes_t lanes_eq(const lanes_t a, const lanes_t b) { return (a == b) ? 0xFF : 0; }
+static inline lanes_t lanes_max(const lanes_t a, const lanes_t b) { return a > b ? a : b; }
+static inline lanes_t lanes_shr1(const lanes_t a) { return a >> 1; }
+static inline lanes_t lanes_shr7(const lanes_t a) { return a >> 7; }
+static inline lanes_t lanes_select(const lanes_t m, const lanes_t a, const lanes_t b) { return (m & a) | (~m & b); }
+static inline bool lanes_any(const lanes_t m) { return m != 0; }
+#endif
+
+#define BATCH_LANE_ALIGN 32		// Lane arrays are padded to this many lanes, a multiple of LANES
+
+// Vector unit the lockstep core was built for, for reports
+const char *chip8_batch_isa(void) {
+	return LANES_ISA;
+}
+
+// Lane's RAM page p: the image's until the lane writes it
+static inline uint8_t **batch_page(const chip8_batch_t *batch, const uint32_t lane, const uint8_t p) {
+	return &batch->ram_page[(size_t)lane * CHIP8_PAGES + p];
+}
+
+static inline uint8_t batch_read_ram(const chip8_batch_t *batch, const uint32_t lane, const uint16_t addr) {
+	return (*batch_page(batch, lane, addr >> CHIP8_PAGE_BITS))[addr & CHIP8_PAGE_MASK];
+}
+
+// Lane's RAM page p made writable: copied from the image on first write
+static uint8_t *batch_own_page(chip8_batch_t *batch, const uint32_t lane, const uint8_t p) {
+	uint8_t **page = batch_page(batch, lane, p);
+	if (*page != &batch->image[p * CHIP8_PAGE_SIZE]) return *page;
+
+	uint8_t *own = malloc(CHIP8_PAGE_SIZE);
+	if (!own) {
+		chip8_log("Could not allocate memory for a RAM page\n");
+		abort();
+	}
+	memcpy(own, *page, CHIP8_PAGE_SIZE);
+	*page = own;
+	return own;
+}
+
+static inline uint64_t batch_cycles(const chip8_batch_t *batch, const uint32_t lane) {
+	return batch->steps - batch->idle[lane];
+}
+
+static void *batch_array(uint8_t *base, size_t *used, const size_t bytes) {
+	void *array = base ? base + *used : NULL;
+	*used += bytes;
+	return array;
+}
+
+// Carve the lane arrays out of base, returns the bytes needed. Sizes are
+//	 only counted when base is NULL.
+static size_t batch_layout(chip8_batch_t *batch, uint8_t *base) {
+	const size_t n = batch->stride;
+	size_t used = 0;
+
+	for (uint8_t i = 0; i < 32; i++) batch->display[i] = batch_array(base, &used, n * 8);
+	for (uint8_t i = 0; i < 16; i++) batch->stack[i] = batch_array(base, &used, n * 2);
+	for (uint8_t i = 0; i < 16; i++) batch->V[i] = batch_array(base, &used, n);
+	batch->delay_cycle = batch_array(base, &used, n * 8);
+	batch->sound_cycle = batch_array(base, &used, n * 8);
+	batch->idle = batch_array(base, &used, n * 8);
+	batch->target = batch_array(base, &used, n * 8);
+	batch->rng = batch_array(base, &used, n * 4);
+	batch->I = batch_array(base, &used, n * 2);
+	batch->PC = batch_array(base, &used, n * 2);
+	batch->keypad = batch_array(base, &used, n * 2);
+	batch->stack_ptr = batch_array(base, &used, n);
+	batch->delay_timer = batch_array(base, &used, n);
+	batch->sound_timer = batch_array(base, &used, n);
+	batch->key_wait = batch_array(base, &used, n);
+	batch->mask = batch_array(base, &used, n);
+	batch->group = batch_array(base, &used, n);
+	batch->cond = batch_array(base, &used, n);
+	batch->ram_page = batch_array(base, &used, n * CHIP8_PAGES * sizeof(uint8_t *));
+	return used;
+}
+
+// Load one lane's machine state from chip8. RAM may differ from the image.
+void chip8_batch_set(chip8_batch_t *batch, const uint32_t lane, const chip8_t *chip8) {
+	for (uint8_t i = 0; i < 32; i++) batch->display[i][lane] = chip8->display[i];
+	for (uint8_t i = 0; i < 16; i++) batch->stack[i][lane] = chip8->stack[i];
+	for (uint8_t i = 0; i < 16; i++) batch->V[i][lane] = chip8->V[i];
+	batch->stack_ptr[lane] = chip8->stack_ptr;
+	batch->I[lane] = chip8->I;
+	batch->PC[lane] = chip8->PC;
+	batch->delay_timer[lane] = chip8->delay_timer;
+	batch->sound_timer[lane] = chip8->sound_timer;
+	batch->delay_cycle[lane] = chip8->delay_cycle;
+	batch->sound_cycle[lane] = chip8->sound_cycle;
+	batch->keypad[lane] = chip8->keypad;
+	batch->key_wait[lane] = chip8->key_wait;
+	batch->rng[lane] = chip8->rng;
+	batch->idle[lane] = batch->steps - chip8->cycles;	// Wraps, cycles = steps - idle still holds
+
+	for (uint8_t p = 0; p < CHIP8_PAGES; p++) {
+		const uint8_t *ram = chip8->page[p]->ram;
+		const uint8_t *image = &batch->image[p * CHIP8_PAGE_SIZE];
+		if (memcmp(*batch_page(batch, lane, p), ram, CHIP8_PAGE_SIZE) == 0) continue;
+
+		memcpy(batch_own_page(batch, lane, p), ram, CHIP8_PAGE_SIZE);
+		for (uint16_t i = 0; i < CHIP8_PAGE_SIZE; i++) {
+			const uint16_t addr = p * CHIP8_PAGE_SIZE + i;
+			if (ram[i] != image[i]) batch->written[addr / 8] |= 1 << (addr % 8);
+		}
+	}
+}
+
+// Store one lane's machine state to chip8, ready to run on any other core.
+//	 chip8 must be loaded with the batch's ROM: its RAM is restored as from a
+//	 snapshot, sharing the pages the lane never wrote.
+void chip8_batch_get(const chip8_batch_t *batch, const uint32_t lane, chip8_t *chip8) {
+	chip8_snapshot_t snapshot;
+	chip8_t state = {0};
+
+	for (uint8_t i = 0; i < 32; i++) state.display[i] = batch->display[i][lane];
+	for (uint8_t i = 0; i < 16; i++) state.stack[i] = batch->stack[i][lane];
+	for (uint8_t i = 0; i < 16; i++) state.V[i] = batch->V[i][lane];
+	state.stack_ptr = batch->stack_ptr[lane];
+	state.I = batch->I[lane];
+	state.PC = batch->PC[lane];
+	state.delay_timer = batch->delay_timer[lane];
+	state.sound_timer = batch->sound_timer[lane];
+	state.delay_cycle = batch->delay_cycle[lane];
+	state.sound_cycle = batch->sound_cycle[lane];
+	state.keypad = batch->keypad[lane];
+	state.key_wait = batch->key_wait[lane];
+	state.rng = batch->rng[lane];
+	state.cycles = batch_cycles(batch, lane);
+
+	memcpy(snapshot.data, &state, CHIP8_STATE_SIZE);
+	for (uint8_t p = 0; p < CHIP8_PAGES; p++) {
+		memcpy((uint8_t *)snapshot.data + CHIP8_STATE_SIZE + p * CHIP8_PAGE_SIZE, *batch_page(batch, lane, p), CHIP8_PAGE_SIZE);
+	}
+	chip8_restore(chip8, &snapshot);
+
+	chip8->state = RUNNING;
+	chip8->dirty_rows = 0xFFFFFFFF;
+}
+
+// count instances of chip8 in its current state, NULL if out of memory
+chip8_batch_t *chip8_batch_create(const chip8_t *chip8, const uint32_t count) {
+	chip8_batch_t *batch = calloc(1, sizeof *batch);
+	if (!batch) return NULL;
+
+	batch->count = count;
+	batch->stride = (count + BATCH_LANE_ALIGN - 1) / BATCH_LANE_ALIGN * BATCH_LANE_ALIGN;
+	batch->lanes = calloc(1, batch_layout(batch, NULL));
+	if (!batch->lanes) {
+		free(batch);
+		return NULL;
+	}
+	batch_layout(batch, batch->lanes);
+
+	for (uint8_t p = 0; p < CHIP8_PAGES; p++) {
+		memcpy(&batch->image[p * CHIP8_PAGE_SIZE], chip8->page[p]->ram, CHIP8_PAGE_SIZE);
+		memcpy(&batch->decoded[p * CHIP8_PAGE_SIZE], chip8->page[p]->decoded, CHIP8_PAGE_SIZE * sizeof(instruction_t));
+	}
+	for (uint32_t lane = 0; lane < count; lane++) {
+		for (uint8_t p = 0; p < CHIP8_PAGES; p++) *batch_page(batch, lane, p) = &batch->image[p * CHIP8_PAGE_SIZE];
+		chip8_batch_set(batch, lane, chip8);
+	}
+	return batch;
+}
+
+void chip8_batch_destroy(chip8_batch_t *batch) {
+	if (!batch) return;
+	for (uint32_t lane = 0; lane < batch->count; lane++) {
+		for (uint8_t p = 0; p < CHIP8_PAGES; p++) {
+			uint8_t *page = *batch_page(batch, lane, p);
+			if (page != &batch->image[p * CHIP8_PAGE_SIZE]) free(page);
+		}
+	}
+	free(batch->lanes);
+	free(batch);
+}
+
+// Whether some lane wrote over image in RAM [addr, addr + len), wrapping at 4K.
+//	 If not, every lane's RAM there is the image, which is shared and in cache.
+static inline bool batch_written(const chip8_batch_t *batch, const uint16_t addr, const uint8_t len) {
+	for (uint8_t i = 0; i < len; i++) {
+		const uint16_t a = (addr + i) & 0x0FFF;
+		if (batch->written[a / 8] & (1 << (a % 8))) return true;
+	}
+	return false;
+}
+
+static inline void batch_write_ram(chip8_batch_t *batch, const uint32_t lane, uint16_t addr, const uint8_t value) {
+	addr &= 0x0FFF;
+	if (batch_read_ram(batch, lane, addr) == value) return;
+
+	batch_own_page(batch, lane, addr >> CHIP8_PAGE_BITS)[addr & CHIP8_PAGE_MASK] = value;
+	if (value != batch->image[addr]) batch->written[addr / 8] |= 1 << (addr % 8);
+}
+
+// Next PC of the lanes in the group: taken where cond is set, else not_taken.
+//	 Returns it if they agree, otherwise stores each lane's to PC and returns -1.
+static int32_t batch_branch(chip8_batch_t *batch, const uint16_t not_taken, const uint16_t taken) {
+	lanes_t any_taken = lanes_set(0), any_not_taken = lanes_set(0);
+	for (uint32_t l = 0; l < batch->stride; l += LANES) {
+		const lanes_t m = lanes_load(&batch->mask[l]), c = lanes_load(&batch->cond[l]);
+		any_taken = lanes_or(any_taken, lanes_and(m, c));
+		any_not_taken = lanes_or(any_not_taken, lanes_and(m, lanes_xor(c, lanes_set(0xFF))));
+	}
+	if (!lanes_any(any_taken)) return not_taken;
+	if (!lanes_any(any_not_taken)) return taken;
+
+	for (uint32_t l = 0; l < batch->count; l++) {
+		if (batch->mask[l]) batch->PC[l] = batch->cond[l] ? taken : not_taken;
+	}
+	return -1;
+}
+
+// The group's next PCs are in PC: returns the one they share, or -1
+static int32_t batch_uniform_pc(const chip8_batch_t *batch) {
+	int32_t pc = -1;
+	for (uint32_t l = 0; l < batch->count; l++) {
+		if (!batch->mask[l]) continue;
+		if (pc < 0) pc = batch->PC[l];
+		else if (pc != batch->PC[l]) return -1;
+	}
+	return pc;
+}
+
+// Run inst on the lanes in mask, which are all at PC pc. Returns the PC they
+//	 continue from, or -1 if they went different ways (see batch_branch()).
+//	 Quirks are checked per instruction, not per lane, so they cost nothing
+//	 worth specializing for here.
+static int32_t batch_exec(chip8_batch_t *batch, const instruction_t *inst, const uint16_t pc,
+						  const chip8_config_t *config, const uint8_t quirks) {
+	const uint16_t next = pc + 2;
+	const uint32_t n = batch->stride;
+	const uint8_t *mask = batch->mask;
+	uint8_t *vx = batch->V[inst->X], *vy = batch->V[inst->Y], *vf = batch->V[0xF];
+
+	switch (inst->op) {
+	case OP_CLS:
+		for (uint8_t row = 0; row < 32; row++) {
+			for (uint32_t l = 0; l < n; l++) batch->display[row][l] = mask[l] ? 0 : batch->display[row][l];
+		}
+		return next;
+
+	case OP_RET:
+		for (uint32_t l = 0; l < batch->count; l++) {
+			if (mask[l]) batch->PC[l] = batch->stack[--batch->stack_ptr[l] & 0x0F][l];
+		}
+		return batch_uniform_pc(batch);
+
+	case OP_JP:
+	case OP_JP_SELF:
+	case OP_JP_WAIT:
+		return inst->NNN;
+
+	case OP_CALL:
+		for (uint32_t l = 0; l < batch->count; l++) {
+			if (mask[l]) batch->stack[batch->stack_ptr[l]++ & 0x0F][l] = next;
+		}
+		return inst->NNN;
+
+	case OP_SE_VX_NN:
+	case OP_SNE_VX_NN:
+	case OP_SE_VX_VY:
+	case OP_SNE_VX_VY: {
+		const bool vs_vy = (inst->op == OP_SE_VX_VY || inst->op == OP_SNE_VX_VY);
+		const lanes_t invert = lanes_set((inst->op == OP_SNE_VX_NN || inst->op == OP_SNE_VX_VY) ? 0xFF : 0);
+		for (uint32_t l = 0; l < n; l += LANES) {
+			const lanes_t other = vs_vy ? lanes_load(&vy[l]) : lanes_set(inst->NN);
+			lanes_store(&batch->cond[l], lanes_xor(lanes_eq(lanes_load(&vx[l]), other), invert));
+		}
+		return batch_branch(batch, next, next + 2);
+	}
+
+	case OP_LD_VX_NN:
+		for (uint32_t l = 0; l < n; l += LANES) {
+			lanes_store(&vx[l], lanes_select(lanes_load(&mask[l]), lanes_set(inst->NN), lanes_load(&vx[l])));
+		}
+		return next;
+
+	case OP_ADD_VX_NN:
+		for (uint32_t l = 0; l < n; l += LANES) {
+			const lanes_t x = lanes_load(&vx[l]);
+			lanes_store(&vx[l], lanes_select(lanes_load(&mask[l]), lanes_add(x, lanes_set(inst->NN)), x));
+		}
+		return next;
+
+	case OP_LD_VX_VY:
+	case OP_OR:
+	case OP_AND:
+	case OP_XOR:
+		for (uint32_t l = 0; l < n; l += LANES) {
+			const lanes_t m = lanes_load(&mask[l]), x = lanes_load(&vx[l]), y = lanes_load(&vy[l]);
+			const lanes_t result = (inst->op == OP_LD_VX_VY) ? y :
+								   (inst->op == OP_OR) ? lanes_or(x, y) :
+								   (inst->op == OP_AND) ? lanes_and(x, y) : lanes_xor(x, y);
+			lanes_store(&vx[l], lanes_select(m, result, x));
+			if (inst->op != OP_LD_VX_VY && (quirks & QUIRK_VF_RESET)) {
+				lanes_store(&vf[l], lanes_select(m, lanes_set(0), lanes_load(&vf[l])));
+			}
+		}
+		return next;
+
+	case OP_ADD_VX_VY:
+	case OP_SUB:
+	case OP_SUBN:
+		// Flags from the operands, VF written last as in the scalar handlers
+		for (uint32_t l = 0; l < n; l += LANES) {
+			const lanes_t m = lanes_load(&mask[l]), x = lanes_load(&vx[l]), y = lanes_load(&vy[l]);
+			lanes_t result, flag;
+			if (inst->op == OP_ADD_VX_VY) {
+				result = lanes_add(x, y);
+				flag = lanes_xor(lanes_eq(lanes_max(x, result), result), lanes_set(0xFF));	// Carry: x > x + y
+			} else if (inst->op == OP_SUB) {
+				result = lanes_sub(x, y);
+				flag = lanes_eq(lanes_max(x, y), x);	// No borrow: x >= y
+			} else {
+				result = lanes_sub(y, x);
+				flag = lanes_eq(lanes_max(x, y), y);	// No borrow: y >= x
+			}
+			lanes_store(&vx[l], lanes_select(m, result, x));
+			lanes_store(&vf[l], lanes_select(m, lanes_and(flag, lanes_set(1)), lanes_load(&vf[l])));
+		}
+		return next;
+
+	case OP_SHR:
+	case OP_SHL: {
+		const uint8_t *src = (quirks & QUIRK_SHIFT_VY) ? vy : vx;
+		for (uint32_t l = 0; l < n; l += LANES) {
+			const lanes_t m = lanes_load(&mask[l]), s = lanes_load(&src[l]);
+			const lanes_t result = (inst->op == OP_SHR) ? lanes_shr1(s) : lanes_add(s, s);
+			const lanes_t flag = (inst->op == OP_SHR) ? lanes_and(s, lanes_set(1)) : lanes_shr7(s);
+			lanes_store(&vx[l], lanes_select(m, result, lanes_load(&vx[l])));
+			lanes_store(&vf[l], lanes_select(m, flag, lanes_load(&vf[l])));
+		}
+		return next;
+	}
+
+	case OP_LD_I_NNN:
+		for (uint32_t l = 0; l < n; l++) batch->I[l] = mask[l] ? inst->NNN : batch->I[l];
+		return next;
+
+	case OP_JP_V0: {
+		const uint8_t *v = batch->V[(quirks & QUIRK_JUMP_VX) ? inst->X : 0];
+		for (uint32_t l = 0; l < batch->count; l++) {
+			if (mask[l]) batch->PC[l] = inst->NNN + v[l];
+		}
+		return batch_uniform_pc(batch);
+	}
+
+	case OP_RND:
+		for (uint32_t l = 0; l < n; l++) {
+			uint32_t x = batch->rng[l];
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			batch->rng[l] = mask[l] ? x : batch->rng[l];
+			vx[l] = mask[l] ? (x >> 24) & inst->NN : vx[l];
+		}
+		return next;
+
+	case OP_DRW: {
+		// Sprite rows come from each lane's own I and RAM, so one lane at a time.
+		//	 Lanes mostly share I, so whether its sprite was written is cached.
+		uint32_t checked_I = UINT32_MAX;
+		bool sprite_written = false;
+
+		for (uint32_t l = 0; l < batch->count; l++) {
+			if (!mask[l]) continue;
+			const uint8_t X_coord = vx[l] % CHIP8_DISPLAY_WIDTH;
+			const uint8_t Y_coord = vy[l] % CHIP8_DISPLAY_HEIGHT;
+			const uint8_t rows = (!(quirks & QUIRK_WRAP) && Y_coord + inst->N > CHIP8_DISPLAY_HEIGHT) ?
+								 CHIP8_DISPLAY_HEIGHT - Y_coord : inst->N;
+			if (batch->I[l] != checked_I) {
+				checked_I = batch->I[l];
+				sprite_written = batch_written(batch, checked_I, inst->N);
+			}
+			uint8_t collision = 0;
+
+			for (uint8_t i = 0; i < rows; ++i) {
+				const uint16_t addr = (checked_I + i) & 0x0FFF;
+				const uint64_t sprite_byte = (uint64_t)(sprite_written ? batch_read_ram(batch, l, addr) : batch->image[addr]) << 56;
+				const uint64_t sprite_row = (quirks & QUIRK_WRAP) ?
+											(sprite_byte >> X_coord) | (sprite_byte << ((64 - X_coord) & 63)) :
+											sprite_byte >> X_coord;
+				const uint8_t y = (quirks & QUIRK_WRAP) ? (Y_coord + i) % CHIP8_DISPLAY_HEIGHT : Y_coord + i;
+
+				collision |= (batch->display[y][l] & sprite_row) != 0;
+				batch->display[y][l] ^= sprite_row;
+			}
+			vf[l] = collision;
+		}
+		return next;
+	}
+
+	case OP_SKP:
+	case OP_SKNP: {
+		const uint8_t invert = (inst->op == OP_SKNP) ? 0xFF : 0;
+		for (uint32_t l = 0; l < n; l++) {
+			batch->cond[l] = (uint8_t)-((batch->keypad[l] >> (vx[l] & 0x0F)) & 1) ^ invert;
+		}
+		return batch_branch(batch, next, next + 2);
+	}
+
+	case OP_LD_VX_DT:
+		for (uint32_t l = 0; l < batch->count; l++) {
+			if (mask[l]) {
+				vx[l] = timer_value(batch->delay_timer[l], batch->delay_cycle[l], batch_cycles(batch, l), config);
+			}
+		}
+		return next;
+
+	case OP_LD_VX_K:
+		// As exec_ld_vx_k(); cond is set in lanes that keep waiting
+		for (uint32_t l = 0; l < batch->count; l++) {
+			if (!mask[l]) continue;
+			const uint16_t keypad = batch->keypad[l];
+			if (!batch->key_wait[l] && keypad) {
+				uint8_t key = 0;
+				while (!(keypad & (1u << key))) key++;
+				batch->key_wait[l] = key + 1;
+			}
+
+			batch->cond[l] = 0xFF;
+			if (batch->key_wait[l] && !(keypad & (1u << (batch->key_wait[l] - 1)))) {
+				vx[l] = batch->key_wait[l] - 1;
+				batch->key_wait[l] = 0;
+				batch->cond[l] = 0;
+			}
+		}
+		return batch_branch(batch, next, pc);
+
+	case OP_LD_DT_VX:
+	case OP_LD_ST_VX: {
+		uint8_t *timer = (inst->op == OP_LD_DT_VX) ? batch->delay_timer : batch->sound_timer;
+		uint64_t *timer_cycle = (inst->op == OP_LD_DT_VX) ? batch->delay_cycle : batch->sound_cycle;
+		for (uint32_t l = 0; l < batch->count; l++) {
+			if (mask[l]) {
+				timer[l] = vx[l];
+				timer_cycle[l] = batch_cycles(batch, l);
+			}
+		}
+		return next;
+	}
+
+	case OP_ADD_I_VX:
+		for (uint32_t l = 0; l < n; l++) batch->I[l] += mask[l] ? vx[l] : 0;
+		return next;
+
+	case OP_LD_F_VX:
+		for (uint32_t l = 0; l < n; l++) batch->I[l] = mask[l] ? (vx[l] & 0x0F) * 5 : batch->I[l];
+		return next;
+
+	case OP_LD_B_VX:
+		for (uint32_t l = 0; l < batch->count; l++) {
+			if (!mask[l]) continue;
+			batch_write_ram(batch, l, batch->I[l], vx[l] / 100);
+			batch_write_ram(batch, l, batch->I[l] + 1, vx[l] / 10 % 10);
+			batch_write_ram(batch, l, batch->I[l] + 2, vx[l] % 10);
+		}
+		return next;
+
+	case OP_LD_I_VX:
+	case OP_LD_VX_I:
+		for (uint32_t l = 0; l < batch->count; l++) {
+			if (!mask[l]) continue;
+			for (uint8_t i = 0; i <= inst->X; i++) {
+				if (inst->op == OP_LD_I_VX) batch_write_ram(batch, l, batch->I[l] + i, batch->V[i][l]);
+				else batch->V[i][l] = batch_read_ram(batch, l, (batch->I[l] + i) & 0x0FFF);
+			}
+			if (quirks & QUIRK_MEM_INC_I) batch->I[l] += inst->X + 1;
+		}
+		return next;
+
+	default:
+		return next;	// Unimplemented/invalid
+	}
+}
+
+static inline bool batch_code_written(const chip8_batch_t *batch, const uint16_t addr) {
+	const bool lo_written = addr + 1u < CHIP8_RAM_SIZE && (batch->written[(addr + 1) / 8] & (1 << ((addr + 1) % 8)));
+	return lo_written || (batch->written[addr / 8] & (1 << (addr % 8)));
+}
+
+// Run the instruction at pc on the group in mask, see batch_exec()
+static int32_t batch_step(chip8_batch_t *batch, const uint16_t pc, const chip8_config_t *config, const uint8_t quirks) {
+	const uint16_t addr = pc & 0x0FFF;
+	if (!batch_code_written(batch, addr)) {
+		return batch_exec(batch, &batch->decoded[addr], pc, config, quirks);
+	}
+
+	// Some lane wrote over this instruction: split the group by the opcode
+	//	 each lane actually has there, and run each opcode on its lanes.
+	//	 group is 0xFF for lanes still to run, 1 for lanes that have.
+	memcpy(batch->group, batch->mask, batch->stride);
+	for (uint32_t first = 0; first < batch->count; first++) {
+		if (batch->group[first] != 0xFF) continue;
+
+		const uint8_t hi = batch_read_ram(batch, first, addr);
+		const uint8_t lo = addr + 1u < CHIP8_RAM_SIZE ? batch_read_ram(batch, first, addr + 1) : 0;
+		const uint16_t opcode = (hi << 8) | lo;
+		memset(batch->mask, 0, first);
+		for (uint32_t l = first; l < batch->count; l++) {
+			const bool same = batch->group[l] == 0xFF && batch_read_ram(batch, l, addr) == hi &&
+							  (addr + 1u >= CHIP8_RAM_SIZE || batch_read_ram(batch, l, addr + 1) == lo);
+			batch->mask[l] = same ? 0xFF : 0;
+			if (same) batch->group[l] = 1;
+		}
+
+		const instruction_t inst = decode_instruction(opcode);
+		const int32_t next = batch_exec(batch, &inst, pc, config, quirks);
+		if (next >= 0) {
+			for (uint32_t l = first; l < batch->count; l++) {
+				if (batch->mask[l]) batch->PC[l] = next;
+			}
+		}
+	}
+
+	// Back to the whole group, every lane's next PC is in PC
+	for (uint32_t l = 0; l < batch->count; l++) batch->mask[l] = batch->group[l] ? 0xFF : 0;
+	return batch_uniform_pc(batch);
+}
+
+// Whether the instruction at pc is a skip, with it and the instruction it
+//	 skips both as predecoded for every lane
+static inline bool batch_is_skip(const chip8_batch_t *batch, const uint16_t pc) {
+	const uint16_t addr = pc & 0x0FFF;
+	const uint8_t op = batch->decoded[addr].op;
+	return (op == OP_SE_VX_NN || op == OP_SNE_VX_NN || op == OP_SE_VX_VY || op == OP_SNE_VX_VY ||
+			op == OP_SKP || op == OP_SKNP) &&
+		   !batch_code_written(batch, addr) && !batch_code_written(batch, (addr + 2) & 0x0FFF);
+}
+
+// After a skip split the group, run the instruction at skipped on the lanes
+//	 at it, while the rest of the group waits a step. Returns the PC the whole
+//	 group continues from, or -1 if it is still split (see batch_branch()).
+static int32_t batch_predicate(chip8_batch_t *batch, const uint16_t skipped,
+							   const chip8_config_t *config, const uint8_t quirks) {
+	memcpy(batch->group, batch->mask, batch->stride);
+	for (uint32_t l = 0; l < batch->count; l++) {
+		const bool runs = batch->group[l] && batch->PC[l] == skipped;
+		batch->mask[l] = runs ? 0xFF : 0;
+		batch->idle[l] += batch->group[l] && !runs;
+	}
+
+	const int32_t next = batch_exec(batch, &batch->decoded[skipped & 0x0FFF], skipped, config, quirks);
+	for (uint32_t l = 0; l < batch->count; l++) {
+		if (batch->mask[l] && next >= 0) batch->PC[l] = next;
+		batch->mask[l] = batch->group[l];
+	}
+	return batch_uniform_pc(batch);
+}
+
+// Emulate count more CHIP8 instructions on every lane. Lanes end up exactly
+//	 as if each had run on its own with run_core().
+void chip8_batch_run(chip8_batch_t *batch, const chip8_config_t config, const uint64_t count) {
+	const uint8_t quirks = profile_quirks[config.profile];
+	for (uint32_t l = 0; l < batch->count; l++) batch->target[l] = batch_cycles(batch, l) + count;
+
+	for (;;) {
+		// Lead with the running lane furthest behind, ties to the lowest PC
+		uint32_t leader = UINT32_MAX;
+		uint64_t leader_cycles = 0;
+		for (uint32_t l = 0; l < batch->count; l++) {
+			const uint64_t cycles = batch_cycles(batch, l);
+			if (cycles >= batch->target[l]) continue;
+			if (leader == UINT32_MAX || cycles < leader_cycles ||
+				(cycles == leader_cycles && batch->PC[l] < batch->PC[leader])) {
+				leader = l;
+				leader_cycles = cycles;
+			}
+		}
+		if (leader == UINT32_MAX) return;	// Every lane ran count instructions
+
+		// The group is every running lane at the leader's PC. It runs until one
+		//	 of its lanes is done or its lanes go different ways, and while other
+		//	 lanes wait at other PCs, no further than the next furthest behind.
+		const uint16_t pc = batch->PC[leader];
+		uint64_t steps = UINT64_MAX;
+		for (uint32_t l = 0; l < batch->count; l++) {
+			const uint64_t cycles = batch_cycles(batch, l);
+			const bool running = cycles < batch->target[l];
+			batch->mask[l] = (running && batch->PC[l] == pc) ? 0xFF : 0;
+
+			const uint64_t limit = batch->mask[l] ? batch->target[l] - cycles :
+								   running ? (cycles > leader_cycles ? cycles - leader_cycles : 1) : UINT64_MAX;
+			if (limit < steps) steps = limit;
+		}
+
+		uint64_t ran = 0;
+		int32_t next = pc;
+		while (ran < steps && next >= 0) {
+			// Jump to itself: nothing changes until the steps are used up
+			const instruction_t *inst = &batch->decoded[next & 0x0FFF];
+			if (inst->op == OP_JP_SELF && inst->NNN == next && !batch_code_written(batch, next)) {
+				batch->steps += steps - ran;
+				ran = steps;
+				break;
+			}
+
+			const uint16_t at = next;
+			batch->steps++;
+			ran++;
+			next = batch_step(batch, at, &config, quirks);
+
+			// Lanes split over a skip: the ones that don't skip run the skipped
+			//	 instruction while the others wait a step, which usually brings
+			//	 the group back together without regrouping every lane
+			if (next < 0 && ran < steps && batch_is_skip(batch, at)) {
+				batch->steps++;
+				ran++;
+				next = batch_predicate(batch, at + 2, &config, quirks);
+			}
+		}
+
+		// Lanes outside the group sat those steps out
+		for (uint32_t l = 0; l < batch->count; l++) {
+			if (!batch->mask[l]) batch->idle[l] += ran;
+			else if (next >= 0) batch->PC[l] = next;
+		}
+	}
+}
+
+// 64-bit FNV-1a hash, continued from hash
+uint64_t fnv1a(uint64_t hash, const void *data, const size_t len) {
+	const uint8_t *bytes = data;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+// Hash of RAM, the same as fnv1a() over all 4096 bytes
+uint64_t hash_ram(const chip8_t *chip8) {
+	uint64_t hash = FNV1A_INIT;
+	for (uint8_t p = 0; p < CHIP8_PAGES; p++) hash = fnv1a(hash, chip8->page[p]->ram, CHIP8_PAGE_SIZE);
+	return hash;
+}
+
+uint64_t hash_framebuffer(const chip8_t *chip8) {
+	return fnv1a(FNV1A_INIT, chip8->display, sizeof chip8->display);
+}
+
+// Hash of everything that makes up machine state
+uint64_t hash_state(const chip8_t *chip8) {
+	const uint8_t stack_depth = chip8->stack_ptr & 0x0F;
+	uint64_t hash = hash_ram(chip8);
+
+	hash = fnv1a(hash, chip8->display, sizeof chip8->display);
+	hash = fnv1a(hash, chip8->stack, sizeof chip8->stack);
+	hash = fnv1a(hash, &stack_depth, sizeof stack_depth);
+	hash = fnv1a(hash, chip8->V, sizeof chip8->V);
+	hash = fnv1a(hash, &chip8->I, sizeof chip8->I);
+	hash = fnv1a(hash, &chip8->PC, sizeof chip8->PC);
+	hash = fnv1a(hash, &chip8->delay_timer, sizeof chip8->delay_timer);
+	hash = fnv1a(hash, &chip8->sound_timer, sizeof chip8->sound_timer);
+	hash = fnv1a(hash, &chip8->delay_cycle, sizeof chip8->delay_cycle);
+	hash = fnv1a(hash, &chip8->sound_cycle, sizeof chip8->sound_cycle);
+	hash = fnv1a(hash, &chip8->keypad, sizeof chip8->keypad);
+	hash = fnv1a(hash, &chip8->rng, sizeof chip8->rng);
+	return hash;
+}
+
+// Instructions to run in this 60hz frame. The fractional part of
+//	 insts_per_second / 60 carries over in remainder so the rate is exact.
+uint64_t instructions_this_frame(const chip8_config_t config, uint32_t *remainder) {
+	*remainder += config.insts_per_second;
+	const uint64_t count = *remainder / 60;
+	*remainder %= 60;
+	return count;
+}
+
+// Emulate one 60hz frame of emulated time: up to the next timer tick, where
+//	 instructions_this_frame() ends a frame when counting from cycle 0. Needs
+//	 no state of its own, so it stays in step across snapshots and rewinds.
+//	 Below 60 instructions per second every frame runs at least one, and an
+//	 unlimited rate steps frames of the default rate.
+void chip8_run_frame(core_state_t *core, chip8_t *chip8, const chip8_config_t config) {
+	const uint64_t rate = timer_rate(&config);
+	const uint64_t frame = ((chip8->cycles + 1) * 60 + rate - 1) / rate;	// First frame to end after cycles
+	run_core(core, chip8, config, frame * rate / 60 - chip8->cycles);
+}
+
+// Append a keypad change at cycle to a movie being recorded
+bool movie_record(movie_t *movie, const uint64_t cycle, const uint8_t key, const bool down) {
+	if (movie->count == movie->capacity) {
+		const uint32_t capacity = movie->capacity ? movie->capacity * 2 : 1024;
+		movie_event_t *events = realloc(movie->events, capacity * sizeof *events);
+		if (!events) {
+			chip8_log("Could not grow movie, key change dropped\n");
+			return false;
+		}
+		movie->events = events;
+		movie->capacity = capacity;
+	}
+
+	movie->events[movie->count++] = (movie_event_t){ .cycle = cycle, .key = key, .down = down };
+	return true;
+}
+
+// Drop recorded changes at or after cycle, e.g. when rewinding to it
+void movie_truncate(movie_t *movie, const uint64_t cycle) {
+	while (movie->count && movie->events[movie->count - 1].cycle >= cycle) movie->count--;
+}
+
+// Movie file format, version 1. All values little endian:
+//	 "C8MV", u16 version, u64 rom_hash, u32 seed, u32 insts_per_second,
+//	 u8 profile, u64 final_cycles, u64 state_hash, u64 framebuffer_hash,
+//	 u32 event count, then per event: varint cycles since the previous
+//	 event, u8 key | down << 7
+#define MOVIE_MAGIC "C8MV"
+#define MOVIE_VERSION 1
+#define MOVIE_HEADER_SIZE (4 + 2 + 8 + 4 + 4 + 1 + 8 + 8 + 8 + 4)
+#define MOVIE_MAX_EVENT_SIZE (10 + 1)	// Longest varint + key byte
+
+bool movie_save(const movie_t *movie, const char *path) {
+	uint8_t *buffer = malloc(MOVIE_HEADER_SIZE + (size_t)movie->count * MOVIE_MAX_EVENT_SIZE);
+	if (!buffer) {
+		chip8_log("Could not allocate memory to save movie %s\n", path);
+		return false;
+	}
+
+	uint8_t *p = buffer;
+	memcpy(p, MOVIE_MAGIC, 4);
+	p = put_le(p + 4, MOVIE_VERSION, 2);
+	p = put_le(p, movie->rom_hash, 8);
+	p = put_le(p, movie->seed, 4);
+	p = put_le(p, movie->insts_per_second, 4);
+	p = put_le(p, movie->profile, 1);
+	p = put_le(p, movie->final_cycles, 8);
+	p = put_le(p, movie->state_hash, 8);
+	p = put_le(p, movie->framebuffer_hash, 8);
+	p = put_le(p, movie->count, 4);
+
+	uint64_t cycle = 0;
+	for (uint32_t i = 0; i < movie->count; i++) {
+		p = put_varint(p, movie->events[i].cycle - cycle);
+		*p++ = movie->events[i].key | (movie->events[i].down << 7);
+		cycle = movie->events[i].cycle;
+	}
+
+	FILE *file = fopen(path, "wb");
+	bool written = file && fwrite(buffer, p - buffer, 1, file) == 1;
+	if (file && fclose(file) != 0) written = false;
+	free(buffer);
+
+	if (!written) chip8_log("Could not write movie %s\n", path);
+	return written;
+}
+
+bool movie_load(movie_t *movie, const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		chip8_log("Movie %s does not exist\n", path);
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	const long size = ftell(file);
+	rewind(file);
+
+	uint8_t *buffer = (size > 0) ? malloc(size) : NULL;
+	const bool read = buffer && fread(buffer, size, 1, file) == 1;
+	fclose(file);
+
+	uint64_t version = 0, value;
+	if (read && size >= MOVIE_HEADER_SIZE) get_le(buffer + 4, &version, 2);
+	if (!read || size < MOVIE_HEADER_SIZE || memcmp(buffer, MOVIE_MAGIC, 4) != 0 || version != MOVIE_VERSION) {
+		chip8_log("Movie %s is corrupted or from an unsupported version\n", path);
+		free(buffer);
+		return false;
+	}
+
+	const uint8_t *p = buffer + 6;
+	const uint8_t *end = buffer + size;
+	*movie = (movie_t){0};
+	p = get_le(p, &movie->rom_hash, 8);
+	p = get_le(p, &value, 4); movie->seed = value;
+	p = get_le(p, &value, 4); movie->insts_per_second = value;
+	p = get_le(p, &value, 1); movie->profile = value;
+	p = get_le(p, &movie->final_cycles, 8);
+	p = get_le(p, &movie->state_hash, 8);
+	p = get_le(p, &movie->framebuffer_hash, 8);
+	p = get_le(p, &value, 4);
+
+	// Every event takes at least 2 bytes
+	const uint32_t count = value;
+	movie->events = malloc(((size_t)count ? count : 1) * sizeof *movie->events);
+	if (!movie->events || count > (size_t)(end - p) / 2 || movie->profile >= PROFILE_COUNT) {
+		chip8_log("Movie %s is corrupted\n", path);
+		free(movie->events);
+		free(buffer);
+		return false;
+	}
+
+	uint64_t cycle = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		// The varint and key byte must both be inside the file
+		const uint8_t *key = p;
+		while (key < end && (*key & 0x80)) key++;
+		if (end - key < 2 || key - p >= 10) {
+			chip8_log("Movie %s is truncated\n", path);
+			free(movie->events);
+			free(buffer);
+			return false;
+		}
+
+		p = get_varint(p, &value);
+		cycle += value;
+		movie->events[i] = (movie_event_t){ .cycle = cycle, .key = *p & 0x0F, .down = *p >> 7 };
+		p++;
+	}
+	movie->count = movie->capacity = count;
+
+	free(buffer);
+	return true;
+}
+
+// Online CPUs, at least 1
+uint32_t chip8_cpu_count(void) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+#else
+	const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? cpus : 1;
+#endif
+}
+
+// Batched environments
+// Many instances of one ROM stepped together for reinforcement learning, so
+//	 a caller crossing a slow FFI boundary pays for one call per step rather
+//	 than one per instance. A step runs on a pool of threads kept alive for
+//	 the environments' lifetime; each thread owns a fixed slice of instances,
+//	 and the calling thread runs the first slice itself. A slice's instances
+//	 share one core, so a step costs one block cache or JIT buffer per thread
+//	 rather than per instance; see core_share(). Resets restore the snapshot
+//	 taken after the ROM was loaded rather than reloading it.
+typedef struct {
+	chip8_envs_t *envs;
+	uint32_t id;				// Slice of instances this thread steps
+} chip8_envs_worker_t;
+
+struct chip8_envs {
+	chip8_t *machines;
+	core_state_t *cores;		// Core per slice
+	chip8_image_t *image;		// ROM every instance shares RAM pages from
+	uint32_t count;
+	chip8_config_t config;
+	uint16_t reward_addr;		// RAM address of each instance's reward byte
+	chip8_snapshot_t start;		// Checkpoint every instance resets to
+
+	// Current step, set by chip8_envs_step() before waking the workers
+	const uint16_t *actions;
+	uint32_t frames;
+	uint64_t *framebuffers;
+	uint8_t *rewards;
+
+	pthread_mutex_t lock;
+	pthread_cond_t wake;		// Signalled when a step is posted or on shutdown
+	pthread_cond_t done;		// Signalled when the last worker finishes a step
+	uint64_t generation;		// Steps posted so far
+	uint32_t pending;			// Workers still running the current step
+	bool quit;
+	uint32_t thread_count;		// Slices, including the caller's
+	pthread_t *threads;			// thread_count - 1 workers
+	chip8_envs_worker_t *workers;
+};
+
+// Run the current step on the instances of slice id
+static void chip8_envs_run_slice(chip8_envs_t *envs, const uint32_t id) {
+	const uint32_t first = (uint64_t)envs->count * id / envs->thread_count;
+	const uint32_t end = (uint64_t)envs->count * (id + 1) / envs->thread_count;
+
+	for (uint32_t i = first; i < end; i++) {
+		chip8_t *chip8 = &envs->machines[i];
+		if (envs->actions) chip8->keypad = envs->actions[i];
+		for (uint32_t frame = 0; frame < envs->frames; frame++) {
+			chip8_run_frame(&envs->cores[id], chip8, envs->config);
+		}
+
+		if (envs->framebuffers) {
+			memcpy(&envs->framebuffers[(size_t)i * CHIP8_DISPLAY_HEIGHT], chip8->display, sizeof chip8->display);
+		}
+		if (envs->rewards) envs->rewards[i] = chip8_ram(chip8, envs->reward_addr);
+	}
+}
+
+static void *chip8_envs_worker(void *arg) {
+	const chip8_envs_worker_t *worker = arg;
+	chip8_envs_t *envs = worker->envs;
+	uint64_t seen = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&envs->lock);
+		while (envs->generation == seen && !envs->quit) pthread_cond_wait(&envs->wake, &envs->lock);
+		if (envs->quit) {
+			pthread_mutex_unlock(&envs->lock);
+			return NULL;
+		}
+		seen = envs->generation;
+		pthread_mutex_unlock(&envs->lock);
+
+		chip8_envs_run_slice(envs, worker->id);
+
+		pthread_mutex_lock(&envs->lock);
+		if (--envs->pending == 0) pthread_cond_signal(&envs->done);
+		pthread_mutex_unlock(&envs->lock);
+	}
+}
+
+// Create count instances of a ROM from memory, instance i seeded with
+//	 seed + i. Steps run on threads threads, 0 for one per CPU. Returns NULL
+//	 on failure.
+chip8_envs_t *chip8_envs_create(const uint8_t *rom, const size_t size, const uint32_t count,
+								const chip8_config_t config, const uint32_t seed,
+								const uint16_t reward_addr, const uint32_t threads) {
+	chip8_envs_t *envs = calloc(1, sizeof *envs);
+	if (!envs) {
+		chip8_log("Could not allocate environments\n");
+		return NULL;
+	}
+
+	envs->count = count;
+	envs->config = config;
+	envs->reward_addr = reward_addr & 0x0FFF;
+	envs->machines = calloc(count ? count : 1, sizeof *envs->machines);
+	envs->thread_count = threads ? threads : chip8_cpu_count();
+	if (envs->thread_count > count) envs->thread_count = count ? count : 1;
+	envs->cores = calloc(envs->thread_count, sizeof *envs->cores);
+	envs->threads = calloc(envs->thread_count, sizeof *envs->threads);
+	envs->workers = calloc(envs->thread_count, sizeof *envs->workers);
+	if (!envs->machines || !envs->cores || !envs->threads || !envs->workers) {
+		chip8_log("Could not allocate %u environments\n", count);
+		free(envs->machines);
+		free(envs->cores);
+		free(envs->threads);
+		free(envs->workers);
+		free(envs);
+		return NULL;
+	}
+	pthread_mutex_init(&envs->lock, NULL);
+	pthread_cond_init(&envs->wake, NULL);
+	pthread_cond_init(&envs->done, NULL);
+
+	// Every instance starts from the same image and snapshot, only the seeds differ
+	envs->image = chip8_image_create(rom, size);
+	if (!envs->image) {
+		envs->thread_count = 1;
+		chip8_envs_destroy(envs);
+		return NULL;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		chip8_load_image(&envs->machines[i], envs->image);
+		chip8_checkpoint(&envs->machines[i], &envs->start);	// The same for every instance
+		seed_chip8(&envs->machines[i], seed + i);
+	}
+
+	for (uint32_t id = 1; id < envs->thread_count; id++) {
+		envs->workers[id] = (chip8_envs_worker_t){ .envs = envs, .id = id };
+		if (pthread_create(&envs->threads[id], NULL, chip8_envs_worker, &envs->workers[id]) != 0) {
+			chip8_log("Could not start environment thread, using %u\n", id);
+			envs->thread_count = id;	// No step has run yet, so no worker has read it
+			break;
+		}
+	}
+	for (uint32_t id = 0; id < envs->thread_count; id++) {
+		init_core(&envs->cores[id], config);
+		core_share(&envs->cores[id]);
+	}
+
+	return envs;
+}
+
+void chip8_envs_destroy(chip8_envs_t *envs) {
+	if (!envs) return;
+
+	if (envs->thread_count > 1) {
+		pthread_mutex_lock(&envs->lock);
+		envs->quit = true;
+		pthread_cond_broadcast(&envs->wake);
+		pthread_mutex_unlock(&envs->lock);
+		for (uint32_t id = 1; id < envs->thread_count; id++) pthread_join(envs->threads[id], NULL);
+	}
+	pthread_mutex_destroy(&envs->lock);
+	pthread_cond_destroy(&envs->wake);
+	pthread_cond_destroy(&envs->done);
+
+	for (uint32_t id = 0; id < envs->thread_count; id++) destroy_core(&envs->cores[id]);
+	for (uint32_t i = 0; i < envs->count; i++) chip8_unload(&envs->machines[i]);
+	chip8_image_destroy(envs->image);
+	free(envs->machines);
+	free(envs->cores);
+	free(envs->threads);
+	free(envs->workers);
+	free(envs);
+}
+
+// Put instances back in their start state: every instance, or those with
+//	 mask[i] set. Each keeps its own random number stream, so successive
+//	 episodes differ but a run is still reproducible from its seed.
+void chip8_envs_reset(chip8_envs_t *envs, const uint8_t *mask) {
+	for (uint32_t i = 0; i < envs->count; i++) {
+		if (mask && !mask[i]) continue;
+
+		chip8_t *chip8 = &envs->machines[i];
+		const uint32_t rng = chip8->rng;
+		chip8_reset(chip8, &envs->start);
+		chip8->rng = rng;
+	}
+}
+
+// Hold each instance's keys at actions[i] (bit n = key n) for frames_per_step
+//	 60hz frames, then write its display rows to framebuffers[i * 32] and its
+//	 reward byte to rewards[i]. actions, framebuffers and rewards may each be
+//	 NULL to leave keys as they are or skip that output; 0 frames only reads.
+void chip8_envs_step(chip8_envs_t *envs, const uint16_t *actions, const uint32_t frames_per_step,
+					 uint64_t *framebuffers, uint8_t *rewards) {
+	envs->actions = actions;
+	envs->frames = frames_per_step;
+	envs->framebuffers = framebuffers;
+	envs->rewards = rewards;
+
+	if (envs->thread_count == 1) {
+		chip8_envs_run_slice(envs, 0);
+		return;
+	}
+
+	pthread_mutex_lock(&envs->lock);
+	envs->generation++;
+	envs->pending = envs->thread_count - 1;
+	pthread_cond_broadcast(&envs->wake);
+	pthread_mutex_unlock(&envs->lock);
+
+	chip8_envs_run_slice(envs, 0);
+
+	pthread_mutex_lock(&envs->lock);
+	while (envs->pending) pthread_cond_wait(&envs->done, &envs->lock);
+	pthread_mutex_unlock(&envs->lock);
+}
+
+// The machine state of instance i, e.g. to read more of its RAM
+chip8_t *chip8_envs_machine(chip8_envs_t *envs, const uint32_t i) {
+	return &envs->machines[i];
+}
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chip8.h"
+
+// libchip8 regression tests, run with make test. Each prints what it found
+//	 wrong and returns false on failure.
+
+static const chip8_config_t test_configs[] = {
+	{ .core = CORE_INTERPRETER, .profile = PROFILE_CHIP8, .insts_per_second = DEFAULT_INSTS_PER_SECOND },
+	{ .core = CORE_BLOCK, .profile = PROFILE_CHIP8, .insts_per_second = DEFAULT_INSTS_PER_SECOND },
+	{ .core = CORE_JIT, .profile = PROFILE_CHIP8, .insts_per_second = DEFAULT_INSTS_PER_SECOND },
+};
+
+// Loading a ROM into a machine a core has been running must not run the last
+//	 ROM's cached or translated code
+static bool test_reload_live_core(const chip8_config_t config) {
+	const uint8_t first[] = { 0x60, 0x05, 0x70, 0x01, 0x12, 0x02 };	// V0 = 5, then V0 += 1 forever
+	const uint8_t second[] = { 0x60, 0x0A, 0x70, 0x02, 0x12, 0x02 };	// V0 = 10, then V0 += 2 forever
+
+	chip8_t *chip8 = chip8_create();
+	core_state_t core;
+	if (!chip8 || !init_core(&core, config)) {
+		chip8_destroy(chip8);
+		return false;
+	}
+
+	bool ok = true;
+	const uint8_t *roms[] = { first, second };
+	const uint8_t expected[] = { 55, 110 };
+	for (uint8_t r = 0; r < 2; r++) {
+		if (!chip8_load_rom(chip8, roms[r], sizeof first)) ok = false;
+		run_core(&core, chip8, config, 101);
+		if (chip8->V[0] != expected[r]) {
+			printf("reload on live %s core: ROM %u left V0 = %u, expected %u\n",
+				   core_name(&core), r + 1, chip8->V[0], expected[r]);
+			ok = false;
+		}
+	}
+
+	destroy_core(&core);
+	chip8_destroy(chip8);
+	return ok;
+}
+
+int main(void) {
+	uint32_t failed = 0;
+
+	for (size_t i = 0; i < sizeof test_configs / sizeof test_configs[0]; i++) {
+		failed += !test_reload_live_core(test_configs[i]);
+	}
+
+	printf("%s\n", failed ? "FAILED" : "OK");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}